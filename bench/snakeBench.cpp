@@ -0,0 +1,363 @@
+// Microbenchmarks for the snake core and the renderer.
+//
+//   g++ -O2 -pthread bench/snakeBench.cpp -o snakeBench
+//   ./snakeBench [--max-side N] [--min-ms T] > results.jsonl
+//
+// Every measurement is one JSON object per line:
+//   {"bench":"move","impl":"ring","width":30,"height":20,"length":3,"ops":...,"ns_per_op":...}
+// "impl":"ring" is the current code; "impl":"vector" is a copy of the
+// original vector-based algorithms kept here as the regression baseline.
+// The vector versions are O(length) or worse per op, so they only run up to
+// the lengths where they finish in reasonable time.
+
+#define SNAKECYCLE_NO_MAIN
+#include "../snakeCycle.cpp"
+
+namespace {
+
+typedef std::chrono::steady_clock BenchClock;
+
+int minMillis = 200;
+
+// A Hamiltonian cycle for even heights: right along row 0, serpentine
+// through columns 1..W-1 on the rows below, then back up column 0. A snake
+// that follows it never collides, at any length.
+Direction cycleDirection(const Position& p, int width, int height) {
+    if (p.x == 0) return p.y > 0 ? UP : RIGHT;
+    if (p.y == 0) return p.x < width - 1 ? RIGHT : DOWN;
+    if (p.y % 2 == 1) {
+        if (p.x > 1) return LEFT;
+        return p.y == height - 1 ? LEFT : DOWN;
+    }
+    return p.x < width - 1 ? RIGHT : DOWN;
+}
+
+// Lays a snake of `length` cells along the cycle, head last.
+void layOnCycle(Snake& snake, int width, int height, int length) {
+    snake.clearBody();
+    Position p(0, 0);
+    for (int i = 0; i < length; i++) {
+        snake.pushHead(p);
+        p = stepFrom(p, cycleDirection(p, width, height));
+    }
+    snake.forceDirection(cycleDirection(snake.getHead(), width, height));
+}
+
+std::vector<Position> cycleBody(int width, int height, int length) {
+    std::vector<Position> body(static_cast<size_t>(length));
+    Position p(0, 0);
+    for (int i = 0; i < length; i++) {
+        body[static_cast<size_t>(length - 1 - i)] = p;
+        p = stepFrom(p, cycleDirection(p, width, height));
+    }
+    return body;
+}
+
+// Runs op in growing batches until minMillis have passed; ns per call.
+template <typename Op>
+void measure(const char* bench, const char* impl, int width, int height, int length, Op op) {
+    long long ops = 0;
+    long long batch = 1;
+    BenchClock::time_point start = BenchClock::now();
+    double elapsedNs = 0.0;
+    while (true) {
+        for (long long i = 0; i < batch; i++) op();
+        ops += batch;
+        elapsedNs = std::chrono::duration<double, std::nano>(BenchClock::now() - start).count();
+        if (elapsedNs >= minMillis * 1e6) break;
+        if (batch < (1LL << 20)) batch *= 2;
+    }
+    std::printf("{\"bench\":\"%s\",\"impl\":\"%s\",\"width\":%d,\"height\":%d,\"length\":%d,"
+                "\"ops\":%lld,\"ns_per_op\":%.2f}\n",
+                bench, impl, width, height, length, ops, elapsedNs / ops);
+    std::fflush(stdout);
+}
+
+// ---- Original vector-based algorithms, kept as the baseline ----
+
+struct VectorSnake {
+    std::vector<Position> body;
+    std::vector<Position> previousBody;
+
+    void move(Direction dir) {
+        previousBody = body;
+        Position head = stepFrom(body[0], dir);
+        body.insert(body.begin(), head);
+        body.pop_back();
+    }
+
+    bool checkSelfCollision() const {
+        for (size_t i = 1; i < body.size(); i++) {
+            if (body[0] == body[i]) return true;
+        }
+        return false;
+    }
+};
+
+Position vectorGenerateFood(int width, int height, const std::vector<Position>& body, Pcg32& rng) {
+    Position p;
+    do {
+        p.x = static_cast<int>(rng.nextBelow(static_cast<uint32_t>(width)));
+        p.y = static_cast<int>(rng.nextBelow(static_cast<uint32_t>(height)));
+    } while (std::find(body.begin(), body.end(), p) != body.end());
+    return p;
+}
+
+void vectorDrawSnake(const std::vector<Position>& currentBody, const std::vector<Position>& prevBody) {
+    for (const Position& pos : prevBody) {
+        if (std::find(currentBody.begin(), currentBody.end(), pos) == currentBody.end()) {
+            Console::gotoxy(pos.x + 1, pos.y + 4);
+            Console::out() << ' ';
+        }
+    }
+    Console::gotoxy(currentBody[0].x + 1, currentBody[0].y + 4);
+    Console::setColor(LIGHT_GREEN);
+    Console::out() << '>';
+    Console::setColor(GREEN);
+    for (size_t i = 1; i < currentBody.size(); i++) {
+        Console::gotoxy(currentBody[i].x + 1, currentBody[i].y + 4);
+        Console::out() << 'o';
+    }
+}
+
+// Reachable free cells from the head by a queue of positions, the way a
+// straightforward agent would ask.
+int vectorReachable(const Snake& snake, std::vector<Position>& queue, std::vector<char>& seen) {
+    const OccupancyGrid& grid = snake.getOccupancy();
+    static const Direction all[4] = { UP, DOWN, LEFT, RIGHT };
+    seen.assign(static_cast<size_t>(grid.getWidth()) * grid.getHeight(), 0);
+    queue.clear();
+    queue.push_back(snake.getHead());
+    int count = 0;
+    for (size_t i = 0; i < queue.size(); i++) {
+        for (Direction dir : all) {
+            Position p = stepFrom(queue[i], dir);
+            if (!grid.isFree(p)) continue;
+            char& s = seen[static_cast<size_t>(p.y) * grid.getWidth() + p.x];
+            if (s) continue;
+            s = 1;
+            count++;
+            queue.push_back(p);
+        }
+    }
+    return count;
+}
+
+// ---- Suites ----
+
+void benchMove(int w, int h, int length) {
+    Snake snake(w, h);
+    layOnCycle(snake, w, h, length);
+    measure("move", "ring", w, h, length, [&] {
+        snake.setDirection(cycleDirection(snake.getHead(), w, h));
+        snake.move();
+    });
+
+    if (length > (1 << 16)) return;
+    VectorSnake legacy;
+    legacy.body = cycleBody(w, h, length);
+    measure("move", "vector", w, h, length, [&] {
+        legacy.move(cycleDirection(legacy.body[0], w, h));
+    });
+}
+
+void benchSelfCollision(int w, int h, int length) {
+    Snake snake(w, h);
+    layOnCycle(snake, w, h, length);
+    // The ring version answers with one bitmap lookup of the next head
+    // cell, which is what move() does before setting the collision flag.
+    Position next = stepFrom(snake.getHead(), snake.getDirection());
+    volatile bool sink = false;
+    measure("self_collision", "ring", w, h, length, [&] {
+        sink = snake.getOccupancy().isOccupied(next);
+    });
+
+    if (length > (1 << 20)) return;
+    VectorSnake legacy;
+    legacy.body = cycleBody(w, h, length);
+    measure("self_collision", "vector", w, h, length, [&] {
+        sink = legacy.checkSelfCollision();
+    });
+    (void)sink;
+}
+
+void benchGenerateFood(int w, int h, int length) {
+    Snake snake(w, h);
+    layOnCycle(snake, w, h, length);
+    Food food;
+    Pcg32 rng(1);
+    measure("generate_food", "ring", w, h, length, [&] {
+        food.generateFood(snake.getOccupancy(), rng);
+    });
+
+    if (length > (1 << 14)) return;
+    std::vector<Position> body = cycleBody(w, h, length);
+    volatile int sink = 0;
+    measure("generate_food", "vector", w, h, length, [&] {
+        sink = vectorGenerateFood(w, h, body, rng).x;
+    });
+    (void)sink;
+}
+
+void benchDrawSnake(int w, int h, int length) {
+    Console::frame().resize(w + 40, h + 10);
+    Console::frame().discardOutput(true);
+
+    Snake snake(w, h);
+    layOnCycle(snake, w, h, length);
+    GameBoard board(w, h);
+    board.drawSnake(snake);
+    Console::present();
+    measure("draw_snake", "ring", w, h, length, [&] {
+        snake.setDirection(cycleDirection(snake.getHead(), w, h));
+        snake.move();
+        board.drawSnake(snake);
+        Console::present();
+    });
+    measure("draw_snake_full", "ring", w, h, length, [&] {
+        board.resetDrawnFlags();
+        board.drawSnake(snake);
+        Console::present();
+    });
+
+    if (length > 4096) return;
+    VectorSnake legacy;
+    legacy.body = cycleBody(w, h, length);
+    measure("draw_snake", "vector", w, h, length, [&] {
+        legacy.move(cycleDirection(legacy.body[0], w, h));
+        vectorDrawSnake(legacy.body, legacy.previousBody);
+        Console::present();
+    });
+}
+
+void benchFloodFill(int w, int h, int length) {
+    Snake snake(w, h);
+    layOnCycle(snake, w, h, length);
+    FloodFill fill;
+    volatile int sink = 0;
+    measure("flood_fill", "bitwise", w, h, length, [&] {
+        sink = fill.fill(snake.getOccupancy(), snake.getHead());
+    });
+
+    if (static_cast<long long>(w) * h > (1 << 20)) return;
+    std::vector<Position> queue;
+    std::vector<char> seen;
+    measure("flood_fill", "vector", w, h, length, [&] {
+        sink = vectorReachable(snake, queue, seen);
+    });
+    (void)sink;
+}
+
+// A 200x60 view into the board, as the game draws on a big terminal: the
+// cost should depend on the view, not on the board or the snake.
+void benchDrawViewport(int w, int h, int length) {
+    const int screenWidth = 200 + 5 + GameBoard::PANEL_WIDTH;
+    const int screenHeight = 60 + 5;
+    Console::frame().resize(screenWidth, screenHeight);
+    Console::frame().discardOutput(true);
+
+    Snake snake(w, h);
+    layOnCycle(snake, w, h, length);
+    GameBoard board(w, h);
+    board.layout(screenWidth, screenHeight);
+    board.drawSnake(snake);
+    Console::present();
+    measure("draw_view", "ring", w, h, length, [&] {
+        snake.setDirection(cycleDirection(snake.getHead(), w, h));
+        snake.move();
+        board.drawSnake(snake);
+        Console::present();
+    });
+    measure("draw_view_full", "ring", w, h, length, [&] {
+        board.resetDrawnFlags();
+        board.drawSnake(snake);
+        Console::present();
+    });
+}
+
+// Bytes present() sends per tick of a moving snake, with the plain
+// absolute-move output and with everything an xterm-like terminal takes.
+void benchFrameBytes(int w, int h, int length) {
+    const int screenWidth = 200 + 5 + GameBoard::PANEL_WIDTH;
+    const int screenHeight = 60 + 5;
+    const TerminalCaps modes[2] = { TerminalCaps(), TerminalCaps::ansi() };
+    const char* names[2] = { "absolute", "ansi" };
+    for (int m = 0; m < 2; m++) {
+        Console::frame().resize(screenWidth, screenHeight);
+        Console::frame().discardOutput(true);
+        Console::frame().setCapabilities(modes[m]);
+        Snake snake(w, h);
+        layOnCycle(snake, w, h, length);
+        GameBoard board(w, h);
+        board.layout(screenWidth, screenHeight);
+        board.drawSnake(snake);
+        Console::present();
+        const int frames = 2000;
+        size_t bytes = 0;
+        for (int i = 0; i < frames; i++) {
+            snake.setDirection(cycleDirection(snake.getHead(), w, h));
+            snake.move();
+            board.drawSnake(snake);
+            bytes += Console::present();
+        }
+        std::printf("{\"bench\":\"frame_bytes\",\"impl\":\"%s\",\"width\":%d,\"height\":%d,\"length\":%d,"
+                    "\"frames\":%d,\"bytes_per_frame\":%.2f}\n",
+                    names[m], w, h, length, frames, static_cast<double>(bytes) / frames);
+    }
+    Console::frame().setCapabilities(TerminalCaps());
+}
+
+// One step of the random agent, a new episode whenever one ends: the
+// runtime SimulationState against the compile-time 30x20 FixedSimulation.
+template <typename Sim>
+void stepEpisode(Sim& sim, Direction action) {
+    if (sim.isOver() || sim.step(action) == STEP_IDLE) sim.reset();
+}
+
+void benchStep() {
+    SimulationState runtime;
+    Pcg32 rng(1);
+    measure("step", "runtime", 30, 20, 0, [&] {
+        stepEpisode(runtime, safeRandomPolicy(runtime, rng));
+    });
+
+    FixedSimulation<30, 20> fixed;
+    measure("step", "fixed", 30, 20, 0, [&] {
+        stepEpisode(fixed, fixedSafeRandomPolicy(fixed, rng));
+    });
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    int maxSide = 4096;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--max-side" && i + 1 < argc) maxSide = std::atoi(argv[++i]);
+        else if (arg == "--min-ms" && i + 1 < argc) minMillis = std::atoi(argv[++i]);
+        else {
+            std::fprintf(stderr, "usage: %s [--max-side N] [--min-ms T]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    benchStep();
+    const int sides[][2] = { { 30, 20 }, { 256, 256 }, { 1024, 1024 }, { 4096, 4096 } };
+    const double fills[] = { 0.0, 0.25, 0.5, 0.9, 1.0 };
+    for (const int* side : sides) {
+        int w = side[0], h = side[1];
+        if (w > maxSide || h > maxSide) continue;
+        for (double fill : fills) {
+            // 0.0 is the starting snake; 1.0 leaves one cell for the food.
+            int length = fill == 0.0 ? 3 : std::max(3, static_cast<int>(fill * w * h) - (fill == 1.0 ? 1 : 0));
+            benchMove(w, h, length);
+            benchSelfCollision(w, h, length);
+            benchGenerateFood(w, h, length);
+            benchDrawSnake(w, h, length);
+            benchDrawViewport(w, h, length);
+            benchFloodFill(w, h, length);
+            benchFrameBytes(w, h, length);
+        }
+    }
+    return 0;
+}
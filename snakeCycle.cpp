@@ -4,22 +4,53 @@
 #include <cstdlib>
 #include <ctime>
 #include <algorithm>
+#include <array>
 #include <iomanip>
 #include <string>
 #include <csignal>
 #include <cstdio>
 #include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <type_traits>
+#include <new>
 
 #ifdef _WIN32
     #include <windows.h>
     #include <conio.h>
+    #ifndef ENABLE_VIRTUAL_TERMINAL_PROCESSING
+        #define ENABLE_VIRTUAL_TERMINAL_PROCESSING 0x0004
+    #endif
 #else
     #include <unistd.h>
     #include <termios.h>
     #include <sys/ioctl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <sys/file.h>
     #include <sys/select.h>
+    #include <poll.h>
     #include <fcntl.h>
     #include <signal.h>
+    #include <sys/socket.h>
+    #include <sys/uio.h>
+    #include <netinet/in.h>
+    #include <netinet/tcp.h>
+    #include <netdb.h>
+    #ifdef __linux__
+        #include <sys/epoll.h>
+    #endif
 #endif
 
 // ---------------------------- Console Colors ----------------------------
@@ -29,12 +60,598 @@ enum ConsoleColor {
     LIGHT_MAGENTA = 13, LIGHT_YELLOW = 14, BRIGHT_WHITE = 15
 };
 
+// ---------------------------- Frame Buffer ----------------------------
+// What the terminal understands besides absolute cursor moves and colors,
+// read from its terminfo entry, or guessed from the family TERM names when
+// there is none. A frame only uses a shorter sequence the terminal is
+// known to take; the default is the plain CUP-and-SGR output any ANSI
+// terminal shows.
+struct TerminalCaps {
+    bool relativeMoves;    // ESC [ n A/B/C/D
+    bool backspace;        // BS is one cell left
+    bool columnAddress;    // ESC [ n G
+    bool carriageReturn;   // CR is column 0
+    bool color;            // ANSI colors; without them only bold is sent
+
+    TerminalCaps() : relativeMoves(false), backspace(false), columnAddress(false), carriageReturn(false), color(true) {}
+
+    static TerminalCaps ansi() {
+        TerminalCaps caps;
+        caps.relativeMoves = caps.backspace = caps.columnAddress = caps.carriageReturn = true;
+        return caps;
+    }
+
+    static TerminalCaps detect() {
+#ifdef _WIN32
+        // Consoles with virtual terminal processing take all of them.
+        return ansi();
+#else
+        const char* term = std::getenv("TERM");
+        if (!term || !*term || std::strchr(term, '/') || std::strcmp(term, "dumb") == 0) return TerminalCaps();
+        std::vector<unsigned char> entry;
+        TerminalCaps caps;
+        if (readTerminfo(term, entry) && parseTerminfo(entry, caps)) return caps;
+        static const char* const families[] = { "xterm", "screen", "tmux", "rxvt", "linux", "alacritty",
+                                                "kitty", "foot", "wezterm", "konsole", "gnome", "putty",
+                                                "ansi", "cygwin", "vt1", "vt2" };
+        for (const char* family : families) {
+            if (std::strncmp(term, family, std::strlen(family)) != 0) continue;
+            caps = ansi();
+            caps.color = family[0] != 'v';
+            return caps;
+        }
+        return TerminalCaps();
+#endif
+    }
+
+private:
+    static bool readTerminfo(const char* term, std::vector<unsigned char>& entry) {
+        std::vector<std::string> dirs;
+        if (const char* dir = std::getenv("TERMINFO")) dirs.push_back(dir);
+        if (const char* home = std::getenv("HOME")) dirs.push_back(std::string(home) + "/.terminfo");
+        if (const char* list = std::getenv("TERMINFO_DIRS")) {
+            for (const char* p = list; *p;) {
+                const char* end = std::strchr(p, ':');
+                size_t n = end ? static_cast<size_t>(end - p) : std::strlen(p);
+                if (n > 0) dirs.push_back(std::string(p, n));
+                p += n + (end ? 1 : 0);
+            }
+        }
+        static const char* const systemDirs[] = { "/etc/terminfo", "/lib/terminfo", "/usr/share/terminfo",
+                                                   "/usr/lib/terminfo" };
+        dirs.insert(dirs.end(), std::begin(systemDirs), std::end(systemDirs));
+
+        char hex[3];
+        std::snprintf(hex, sizeof(hex), "%02x", static_cast<unsigned char>(term[0]));
+        for (const std::string& dir : dirs) {
+            // Entries sit under their first letter, or its hex code on macOS.
+            const std::string paths[2] = { dir + "/" + term[0] + "/" + term, dir + "/" + hex + "/" + term };
+            for (const std::string& path : paths) {
+                FILE* file = std::fopen(path.c_str(), "rb");
+                if (!file) continue;
+                entry.resize(1 << 16);
+                entry.resize(std::fread(entry.data(), 1, entry.size(), file));
+                std::fclose(file);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // A compiled terminfo entry: a header of six little-endian shorts, the
+    // names, the booleans, the numbers (16 or 32 bits), string offsets and
+    // the string table. Only the capabilities a frame uses are looked at.
+    static bool parseTerminfo(const std::vector<unsigned char>& entry, TerminalCaps& caps) {
+        if (entry.size() < 12) return false;
+        int header[6];
+        for (int i = 0; i < 6; i++) header[i] = static_cast<int16_t>(entry[2 * i] | (entry[2 * i + 1] << 8));
+        int numberBytes = header[0] == 0432 ? 2 : header[0] == 01036 ? 4 : 0;
+        if (numberBytes == 0) return false;
+        for (int i = 1; i < 6; i++) {
+            if (header[i] < 0) return false;
+        }
+        size_t numbers = 12 + static_cast<size_t>(header[1]) + header[2];
+        numbers += numbers & 1;
+        size_t offsets = numbers + static_cast<size_t>(header[3]) * numberBytes;
+        size_t table = offsets + 2 * static_cast<size_t>(header[4]);
+        if (table + static_cast<size_t>(header[5]) > entry.size()) return false;
+
+        auto number = [&](int index) {
+            if (index >= header[3]) return -1;
+            size_t at = numbers + static_cast<size_t>(index) * numberBytes;
+            int value = static_cast<int16_t>(entry[at] | (entry[at + 1] << 8));
+            if (numberBytes == 4) value = static_cast<int32_t>(entry[at] | (entry[at + 1] << 8) | (entry[at + 2] << 16) |
+                                                              (static_cast<uint32_t>(entry[at + 3]) << 24));
+            return value;
+        };
+        // The capability without its $<n> padding, or "" when absent.
+        auto string = [&](int index) {
+            std::string value;
+            if (index >= header[4]) return value;
+            int at = static_cast<int16_t>(entry[offsets + 2 * index] | (entry[offsets + 2 * index + 1] << 8));
+            if (at < 0 || at >= header[5]) return value;
+            for (size_t i = table + at; i < table + header[5] && entry[i]; i++) value += static_cast<char>(entry[i]);
+            size_t pad = value.find("$<");
+            if (pad != std::string::npos) value.erase(pad, value.find('>', pad) - pad + 1);
+            return value;
+        };
+
+        // Indices from <term.h>: colors 13; cr 2, hpa 8, cub1 14, cud 107,
+        // cub 111, cuf 112, cuu 114.
+        caps.relativeMoves = string(107) == "\033[%p1%dB" && string(111) == "\033[%p1%dD" &&
+                             string(112) == "\033[%p1%dC" && string(114) == "\033[%p1%dA";
+        caps.backspace = string(14) == "\b";
+        caps.columnAddress = string(8) == "\033[%i%p1%dG";
+        caps.carriageReturn = string(2) == "\r";
+        caps.color = number(13) >= 8;
+        return true;
+    }
+};
+
+// Everything the game draws lands in a back buffer of (glyph, color) cells.
+// present() diffs it against the front buffer (what the terminal already
+// shows) and sends only the changed cells, as one string of cursor moves,
+// color changes and glyphs, in a single write. It remembers where the
+// cursor and the color were left, and picks the shortest move and color
+// change the TerminalCaps allow, so a typical tick costs a few dozen bytes.
+// On a terminal the write never blocks: output a slow link has not taken
+// yet waits in a queue, and frames presented meanwhile are dropped, their
+// changes left in the back buffer for the first frame that goes out. On a
+// Windows console the same diff is sent as CHAR_INFO cells instead, one
+// WriteConsoleOutputW call per run of changed cells in a row.
+class FrameBuffer {
+public:
+    struct Cell {
+        char glyph;
+        unsigned char color;
+        bool operator==(const Cell& other) const { return glyph == other.glyph && color == other.color; }
+        bool operator!=(const Cell& other) const { return !(*this == other); }
+    };
+
+private:
+    int width, height;
+    std::vector<Cell> back;
+    std::vector<Cell> front;
+    int penX, penY;
+    unsigned char penColor;
+    bool clearPending;
+    int terminalColor;
+    int cursorX, cursorY;   // where output left the terminal's cursor; -1 unknown
+    TerminalCaps caps;
+    int writeCalls;
+    bool discard;
+    bool dropped;
+    long long droppedFrames;
+    std::string out;
+    std::string pending;   // sent frames the terminal has not taken yet
+    size_t pendingSent;
+    int outputFd;          // -2 until first used
+#ifdef _WIN32
+    std::vector<CHAR_INFO> consoleCells;   // the run being written
+    int consoleOutput;                      // -1 until asked: is stdout a console
+
+    // Older consoles refuse a WriteConsoleOutputW buffer much over 64 KB,
+    // so a run is cut at 32 KB of cells. Up to CONSOLE_GAP unchanged cells
+    // are written again rather than starting another call.
+    static constexpr int CONSOLE_RUN_CELLS = 8192;
+    static constexpr int CONSOLE_GAP = 8;
+#endif
+
+    // A cursor move being tried out; the shortest candidate is appended.
+    struct Sequence {
+        char text[48];
+        int length;
+
+        Sequence() : length(0) {}
+        void add(char c) { text[length++] = c; }
+        void add(const char* p) { while (*p) add(*p++); }
+        void addNumber(int n) {
+            char digits[12];
+            int count = 0;
+            do { digits[count++] = static_cast<char>('0' + n % 10); n /= 10; } while (n > 0);
+            while (count > 0) add(digits[--count]);
+        }
+        // ESC [ n final, leaving out n when it is the default 1.
+        void addControl(int n, char final) {
+            add("\033[");
+            if (n != 1) addNumber(n);
+            add(final);
+        }
+    };
+
+    // Colors are 0-15 in the Windows console order; bit 3 is bold.
+    void appendColor(int color) {
+        static const char hue[8] = { '0', '4', '2', '6', '1', '5', '3', '7' };
+        bool bold = (color & 8) != 0;
+        if (!caps.color) {
+            out += bold ? "\033[1m" : "\033[0m";
+        } else if (terminalColor >= 0 && (terminalColor & 7) == (color & 7) && bold) {
+            out += "\033[1m";
+        } else if (terminalColor >= 0 && (terminalColor & 8) == (color & 8)) {
+            out += "\033[3";
+            out += hue[color & 7];
+            out += 'm';
+        } else {
+            out += bold ? "\033[1;3" : "\033[0;3";
+            out += hue[color & 7];
+            out += 'm';
+        }
+        terminalColor = color;
+    }
+
+    // What the terminal draws a color as: only bold survives without colors.
+    int shownColor(int color) const { return caps.color ? color : color & 8; }
+
+    // From column `from` to `to` on row y, whose cells before `to` the
+    // terminal already shows as they should be.
+    void addColumnMove(Sequence& seq, int from, int to, int y) const {
+        Sequence best;
+        bool found = false;
+        int distance = to > from ? to - from : from - to;
+        if (to == from) return;
+        if (caps.relativeMoves) {
+            best.addControl(distance, to > from ? 'C' : 'D');
+            found = true;
+        }
+        if (caps.columnAddress) {
+            Sequence column;
+            column.addControl(to + 1, 'G');
+            if (!found || column.length < best.length) best = column;
+            found = true;
+        }
+        if (to < from && caps.backspace && (!found || distance < best.length)) {
+            best = Sequence();
+            for (int i = 0; i < distance; i++) best.add('\b');
+            found = true;
+        }
+        // Printing the cells in between again is shorter for a short hop,
+        // when they show in the color the terminal is set to.
+        if (to > from && to <= width && y >= 0 && y < height && (!found || distance < best.length)) {
+            Sequence over;
+            const Cell* row = &front[static_cast<size_t>(y) * width];
+            for (int x = from; x < to; x++) {
+                const Cell& cell = row[x];
+                if (cell.glyph == '\0' || (cell.glyph != ' ' && shownColor(cell.color) != terminalColor)) {
+                    over.length = -1;
+                    break;
+                }
+                over.add(cell.glyph);
+            }
+            if (over.length >= 0) best = over;
+        }
+        for (int i = 0; i < best.length; i++) seq.add(best.text[i]);
+    }
+
+    void appendMove(int x, int y) {
+        // ANSI 1-based coordinates; a row alone means column 1.
+        Sequence best;
+        best.add("\033[");
+        if (x != 0 || y != 0) best.addNumber(y + 1);
+        if (x != 0) {
+            best.add(';');
+            best.addNumber(x + 1);
+        }
+        best.add('H');
+
+        if (cursorX >= 0 && x >= 0 && y >= 0 && caps.relativeMoves) {
+            Sequence rows;
+            if (y != cursorY) rows.addControl(y > cursorY ? y - cursorY : cursorY - y, y > cursorY ? 'B' : 'A');
+            if (rows.length + 1 < best.length) {
+                Sequence relative = rows;
+                addColumnMove(relative, cursorX, x, y);
+                if (relative.length < best.length) best = relative;
+            }
+            if (caps.carriageReturn && x < cursorX && rows.length + 1 < best.length) {
+                Sequence home;
+                home.add('\r');
+                for (int i = 0; i < rows.length; i++) home.add(rows.text[i]);
+                addColumnMove(home, 0, x, y);
+                if (home.length < best.length) best = home;
+            }
+        }
+        out.append(best.text, static_cast<size_t>(best.length));
+        // Off the frame the terminal may have stopped the cursor at its edge.
+        bool inside = x >= 0 && x < width && y >= 0 && y < height;
+        cursorX = inside ? x : -1;
+        cursorY = inside ? y : -1;
+    }
+
+#ifndef _WIN32
+    // A descriptor of our own on the terminal, opened non-blocking: setting
+    // O_NONBLOCK on stdout would change it for the shell as well. Pipes and
+    // files keep plain blocking writes to stdout.
+    int output() {
+        if (outputFd != -2) return outputFd;
+        outputFd = STDOUT_FILENO;
+        const char* name = isatty(STDOUT_FILENO) ? ttyname(STDOUT_FILENO) : nullptr;
+        int fd = name ? open(name, O_WRONLY | O_NOCTTY | O_NONBLOCK | O_CLOEXEC) : -1;
+        if (fd >= 0) outputFd = fd;
+        return outputFd;
+    }
+#endif
+
+#ifdef _WIN32
+    bool isConsole() {
+        if (consoleOutput < 0) {
+            DWORD mode = 0;
+            consoleOutput = GetConsoleMode(GetStdHandle(STD_OUTPUT_HANDLE), &mode) ? 1 : 0;
+        }
+        return consoleOutput == 1;
+    }
+
+    // Colors are console attributes already, so a cell is copied as is.
+    // One row's cells [x, x + n) at (x, y) of the window; false, leaving
+    // front as it was so the cells go out with the next frame, when the
+    // console refuses them.
+    bool writeConsoleRun(HANDLE hOut, SHORT left, SHORT top, int x, int y, int n) {
+        const Cell* row = &back[static_cast<size_t>(y) * width + x];
+        consoleCells.resize(static_cast<size_t>(n));
+        for (int i = 0; i < n; i++) {
+            consoleCells[i].Char.UnicodeChar = static_cast<WCHAR>(static_cast<unsigned char>(row[i].glyph));
+            consoleCells[i].Attributes = row[i].color;
+        }
+        COORD size = { static_cast<SHORT>(n), 1 };
+        COORD from = { 0, 0 };
+        SMALL_RECT region = { static_cast<SHORT>(left + x), static_cast<SHORT>(top + y),
+                              static_cast<SHORT>(left + x + n - 1), static_cast<SHORT>(top + y) };
+        writeCalls++;
+        if (!WriteConsoleOutputW(hOut, consoleCells.data(), size, from, &region)) return false;
+        std::copy(row, row + n, &front[static_cast<size_t>(y) * width + x]);
+        return true;
+    }
+
+    // The frame's origin is the top-left of the visible window. Returns the
+    // bytes passed; a refused write marks the frame dropped.
+    size_t presentToConsole(bool parkCursor) {
+        HANDLE hOut = GetStdHandle(STD_OUTPUT_HANDLE);
+        CONSOLE_SCREEN_BUFFER_INFO info;
+        writeCalls = 0;
+        dropped = false;
+        if (!GetConsoleScreenBufferInfo(hOut, &info)) return 0;
+        SHORT left = info.srWindow.Left;
+        SHORT top = info.srWindow.Top;
+        if (clearPending) {
+            // Whole rows of the window, blank in the default color.
+            COORD origin = { 0, top };
+            DWORD count = static_cast<DWORD>(info.dwSize.X) * (info.srWindow.Bottom - top + 1);
+            DWORD written = 0;
+            FillConsoleOutputCharacterW(hOut, L' ', count, origin, &written);
+            FillConsoleOutputAttribute(hOut, WHITE, count, origin, &written);
+            writeCalls += 2;
+            clearPending = false;
+        }
+
+        size_t sent = 0;
+        for (int y = 0; y < height; y++) {
+            size_t rowStart = static_cast<size_t>(y) * width;
+            int x = 0;
+            while (x < width) {
+                if (back[rowStart + x] == front[rowStart + x]) {
+                    x++;
+                    continue;
+                }
+                int last = x;
+                for (int at = x + 1; at < width && at - x < CONSOLE_RUN_CELLS && at - last <= CONSOLE_GAP; at++) {
+                    if (back[rowStart + at] != front[rowStart + at]) last = at;
+                }
+                int n = last - x + 1;
+                if (writeConsoleRun(hOut, left, top, x, y, n)) sent += static_cast<size_t>(n) * sizeof(CHAR_INFO);
+                else dropped = true;
+                x = last + 1;
+            }
+        }
+        if (dropped) droppedFrames++;
+        if (parkCursor) {
+            COORD cursor = { static_cast<SHORT>(left + std::max(0, penX)), static_cast<SHORT>(top + std::max(0, penY)) };
+            SetConsoleCursorPosition(hOut, cursor);
+        }
+        return sent;
+    }
+#endif
+
+    // Writes the queue; without `block`, only as far as the terminal takes
+    // it now. True once it is empty.
+    bool writePending(bool block) {
+#ifdef _WIN32
+        (void)block;
+        // Redirected output: the ANSI bytes as they are, in blocking writes
+        // that may each take only part of them. A failed write loses the
+        // rest of the frame, which counts as dropped.
+        HANDLE hOut = GetStdHandle(STD_OUTPUT_HANDLE);
+        while (pendingSent < pending.size()) {
+            DWORD written = 0;
+            writeCalls++;
+            if (!WriteFile(hOut, pending.data() + pendingSent, static_cast<DWORD>(pending.size() - pendingSent),
+                           &written, NULL) || written == 0) {
+                dropped = true;
+                droppedFrames++;
+                break;
+            }
+            pendingSent += written;
+        }
+#else
+        int fd = output();
+        while (pendingSent < pending.size()) {
+            ssize_t n = write(fd, pending.data() + pendingSent, pending.size() - pendingSent);
+            writeCalls++;
+            if (n >= 0) {
+                pendingSent += static_cast<size_t>(n);
+                continue;
+            }
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) break;   // the terminal is gone
+            if (!block) return false;
+            struct pollfd writable = { fd, POLLOUT, 0 };
+            ::poll(&writable, 1, -1);
+        }
+#endif
+        pending.clear();
+        pendingSent = 0;
+        return true;
+    }
+
+    void emit() {
+        if (out.empty() || discard) return;
+        pending += out;
+        writePending(false);
+    }
+
+public:
+    FrameBuffer(int w = 80, int h = 30)
+        : width(0), height(0), penX(0), penY(0), penColor(WHITE), clearPending(true), terminalColor(-1),
+          cursorX(-1), cursorY(-1), writeCalls(0), discard(false), dropped(false), droppedFrames(0),
+          pendingSent(0), outputFd(-2) {
+#ifdef _WIN32
+        consoleOutput = -1;
+#endif
+        resize(w, h);
+    }
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    // Null sink: frames are built as usual but never written.
+    void discardOutput(bool on) { discard = on; }
+    // write() calls made by the last present(); normally 0 or 1.
+    int getLastWriteCalls() const { return writeCalls; }
+    // The last present() sent nothing because the terminal was still busy.
+    bool wasLastFrameDropped() const { return dropped; }
+    long long getDroppedFrames() const { return droppedFrames; }
+
+    // Hands the terminal what it will take of earlier frames, without
+    // waiting; true when nothing is left.
+    bool flush() {
+        writeCalls = 0;
+        return discard || writePending(false);
+    }
+    // Waits until the terminal has taken every frame, before writing
+    // around the frame buffer or waiting for a key.
+    void drain() {
+        if (!discard) writePending(true);
+    }
+
+    void setCapabilities(const TerminalCaps& terminal) {
+        caps = terminal;
+        forgetTerminalState();
+    }
+    const TerminalCaps& getCapabilities() const { return caps; }
+
+    // Resizing drops both buffers; the next present() repaints from scratch.
+    void resize(int w, int h) {
+        width = w;
+        height = h;
+        Cell blank = { ' ', WHITE };
+        back.assign(static_cast<size_t>(w) * h, blank);
+        front.assign(static_cast<size_t>(w) * h, blank);
+        clearPending = true;
+        forgetTerminalState();
+    }
+
+    void moveTo(int x, int y) { penX = x; penY = y; }
+    void setColor(int color) { penColor = static_cast<unsigned char>(color & 15); }
+
+    void put(char ch) {
+        if (penX >= 0 && penX < width && penY >= 0 && penY < height) {
+            Cell& cell = back[static_cast<size_t>(penY) * width + penX];
+            cell.glyph = ch;
+            cell.color = penColor;
+        }
+        penX++;
+    }
+
+    void put(const char* text, size_t length) {
+        for (size_t i = 0; i < length; i++) put(text[i]);
+    }
+
+    void clear() {
+        Cell blank = { ' ', WHITE };
+        std::fill(back.begin(), back.end(), blank);
+        std::fill(front.begin(), front.end(), blank);
+        clearPending = true;
+    }
+
+    // The terminal lost what it was showing (e.g. it was resized): repaint
+    // every cell of the back buffer on the next present().
+    void invalidate() {
+        Cell unknown = { '\0', 0 };
+        std::fill(front.begin(), front.end(), unknown);
+        clearPending = true;
+        forgetTerminalState();
+    }
+
+    // Something other than present() changed the terminal's color or moved
+    // its cursor.
+    void forgetTerminalState() {
+        terminalColor = -1;
+        cursorX = cursorY = -1;
+    }
+
+    // Returns the number of bytes sent to the terminal.
+    size_t present(bool parkCursor = false) {
+#ifdef _WIN32
+        if (!discard && isConsole()) return presentToConsole(parkCursor);
+#endif
+        out.clear();
+        dropped = !flush();
+        if (dropped) {
+            droppedFrames++;
+            return 0;
+        }
+        if (clearPending) {
+            out += "\033[2J";
+            clearPending = false;
+        }
+
+        for (int y = 0; y < height; y++) {
+            size_t rowStart = static_cast<size_t>(y) * width;
+            for (int x = 0; x < width; x++) {
+                const Cell& want = back[rowStart + x];
+                Cell& have = front[rowStart + x];
+                if (want == have) continue;
+
+                if (x != cursorX || y != cursorY) appendMove(x, y);
+                // A blank looks the same in every foreground color.
+                if (want.glyph != ' ' && shownColor(want.color) != terminalColor) appendColor(shownColor(want.color));
+                out += want.glyph;
+                have = want;
+                // Past the last column the cursor waits to wrap, wherever
+                // terminals disagree; the next move is absolute.
+                cursorX = x + 1 < width ? x + 1 : -1;
+            }
+        }
+
+        if (parkCursor && (penX != cursorX || penY != cursorY)) appendMove(penX, penY);
+        emit();
+        return out.size();
+    }
+};
+
+// Adapts FrameBuffer to std::ostream so drawing code can keep using
+// operator<< and <iomanip> formatting.
+class FrameStreamBuf : public std::streambuf {
+private:
+    FrameBuffer& frame;
+protected:
+    int_type overflow(int_type ch) override {
+        if (ch != traits_type::eof()) frame.put(static_cast<char>(ch));
+        return ch;
+    }
+    std::streamsize xsputn(const char* s, std::streamsize n) override {
+        frame.put(s, static_cast<size_t>(n));
+        return n;
+    }
+public:
+    explicit FrameStreamBuf(FrameBuffer& fb) : frame(fb) {}
+};
+
 // ---------------------------- Console Utilities ----------------------------
 class Console {
 private:
 #ifndef _WIN32
     static struct termios oldSettings;
     static bool terminalConfigured;
+    static volatile sig_atomic_t resized;
+
+    static void onResize(int) { resized = 1; }
 #endif
 
     // Helper for Linux to set non-blocking canonical off
@@ -60,13 +677,51 @@ private:
     }
 #endif
 
+    // Out-of-band control sequences that are not part of the frame, after
+    // whatever of the frame is still queued.
+    static void writeRaw(const char* sequence) {
+#ifdef _WIN32
+        (void)sequence;
+#else
+        frame().drain();
+        size_t left = std::strlen(sequence);
+        while (left > 0) {
+            ssize_t n = write(STDOUT_FILENO, sequence, left);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            sequence += n;
+            left -= static_cast<size_t>(n);
+        }
+#endif
+    }
+
 public:
     // initialize (safe multi-call)
     static void initialize() {
 #ifdef _WIN32
-        // nothing to do
+        // Frames are sent as ANSI sequences; let the console interpret them.
+        HANDLE hOut = GetStdHandle(STD_OUTPUT_HANDLE);
+        DWORD mode = 0;
+        if (GetConsoleMode(hOut, &mode)) {
+            SetConsoleMode(hOut, mode | ENABLE_VIRTUAL_TERMINAL_PROCESSING);
+        }
 #else
         configureTerminal();
+        std::signal(SIGWINCH, onResize);
+#endif
+        frame().setCapabilities(TerminalCaps::detect());
+    }
+
+    // True once after the terminal window changed size.
+    static bool consumeResize() {
+#ifdef _WIN32
+        return false;
+#else
+        if (!resized) return false;
+        resized = 0;
+        return true;
 #endif
     }
 
@@ -75,39 +730,30 @@ public:
         // nothing to do
 #else
         restoreTerminal();
-        std::cout << "\033[0m"; // reset attributes
-        std::cout.flush();
+        writeRaw("\033[0m"); // reset attributes
+        frame().forgetTerminalState();
 #endif
     }
 
-    static void setColor(int color) {
-#ifdef _WIN32
-        HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
-        SetConsoleTextAttribute(hConsole, static_cast<WORD>(color));
-#else
-        const char* ansiColors[] = {
-            "\033[0;30m", "\033[0;34m", "\033[0;32m", "\033[0;36m",
-            "\033[0;31m", "\033[0;35m", "\033[0;33m", "\033[0;37m",
-            "\033[1;30m", "\033[1;34m", "\033[1;32m", "\033[1;36m",
-            "\033[1;31m", "\033[1;35m", "\033[1;33m", "\033[1;37m"
-        };
-        if (color >= 0 && color < 16) {
-            std::cout << ansiColors[color];
-        }
-#endif
+    // The back buffer all drawing goes to, and a stream that writes into it.
+    static FrameBuffer& frame() {
+        static FrameBuffer buffer;
+        return buffer;
     }
 
-    static void gotoxy(int x, int y) {
-#ifdef _WIN32
-        COORD coord{ static_cast<SHORT>(x), static_cast<SHORT>(y) };
-        SetConsoleCursorPosition(GetStdHandle(STD_OUTPUT_HANDLE), coord);
-#else
-        // ANSI 1-based coordinates
-        std::cout << "\033[" << (y + 1) << ";" << (x + 1) << "H";
-        std::cout.flush();
-#endif
+    static std::ostream& out() {
+        static FrameStreamBuf streamBuf(frame());
+        static std::ostream stream(&streamBuf);
+        return stream;
     }
 
+    // Sends everything drawn since the last call in one write.
+    static size_t present(bool parkCursor = false) { return frame().present(parkCursor); }
+
+    static void setColor(int color) { frame().setColor(color); }
+
+    static void gotoxy(int x, int y) { frame().moveTo(x, y); }
+
     static void hideCursor() {
 #ifdef _WIN32
         CONSOLE_CURSOR_INFO cursorInfo;
@@ -115,8 +761,7 @@ public:
         cursorInfo.bVisible = FALSE;
         SetConsoleCursorInfo(GetStdHandle(STD_OUTPUT_HANDLE), &cursorInfo);
 #else
-        std::cout << "\033[?25l";
-        std::cout.flush();
+        writeRaw("\033[?25l");
 #endif
     }
 
@@ -127,17 +772,28 @@ public:
         cursorInfo.bVisible = TRUE;
         SetConsoleCursorInfo(GetStdHandle(STD_OUTPUT_HANDLE), &cursorInfo);
 #else
-        std::cout << "\033[?25h";
-        std::cout.flush();
+        writeRaw("\033[?25h");
 #endif
     }
 
-    static void clearScreen() {
+    // Blanks the back buffer; the terminal itself is cleared on the next present().
+    static void clearScreen() { frame().clear(); }
+
+    // Size of the terminal window in cells; false when it cannot be asked
+    // (output is not a terminal).
+    static bool getTerminalSize(int& columns, int& rows) {
 #ifdef _WIN32
-        system("cls");
+        CONSOLE_SCREEN_BUFFER_INFO info;
+        if (!GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &info)) return false;
+        columns = info.srWindow.Right - info.srWindow.Left + 1;
+        rows = info.srWindow.Bottom - info.srWindow.Top + 1;
+        return true;
 #else
-        std::cout << "\033[2J\033[1;1H";
-        std::cout.flush();
+        struct winsize ws;
+        if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) != 0 || ws.ws_col == 0 || ws.ws_row == 0) return false;
+        columns = ws.ws_col;
+        rows = ws.ws_row;
+        return true;
 #endif
     }
 
@@ -150,9 +806,10 @@ public:
         SetConsoleWindowInfo(hOut, TRUE, &windowSize);
 #else
         // Hint to many terminals; harmless if ignored.
-        std::cout << "\033[8;" << height << ";" << width << "t";
-        std::cout.flush();
+        std::string hint = "\033[8;" + std::to_string(height) + ";" + std::to_string(width) + "t";
+        writeRaw(hint.c_str());
 #endif
+        frame().resize(width, height);
     }
 
     // Non-blocking keyboard check
@@ -220,6 +877,7 @@ public:
 #ifndef _WIN32
 struct termios Console::oldSettings;
 bool Console::terminalConfigured = false;
+volatile sig_atomic_t Console::resized = 0;
 #endif
 
 // Restore terminal on signal
@@ -238,352 +896,4872 @@ struct Position {
 
 enum Direction { UP, DOWN, LEFT, RIGHT, STOP };
 
-// ---------------------------- Food ----------------------------
-class Food {
+// UP/DOWN and LEFT/RIGHT differ only in the low bit.
+inline bool isReverse(Direction a, Direction b) { return a != STOP && b != STOP && (a ^ 1) == b; }
+
+// ---------------------------- Snake Body (ring buffer) ----------------------------
+// Fixed-capacity circular deque of segments. Index 0 is the head; pushing a
+// head and popping the tail are O(1) and never allocate after construction.
+class BodyRing {
 private:
-    Position position;
-    char symbol;
-    int color;
-    int value;
-public:
-    Food() : position(0, 0), symbol('*'), color(LIGHT_RED), value(10) {}
-    void generateFood(int width, int height, const std::vector<Position>& snakeBody) {
-        do {
-            position.x = rand() % width;
-            position.y = rand() % height;
-        } while (std::find(snakeBody.begin(), snakeBody.end(), position) != snakeBody.end());
+    std::vector<Position> cells;
+    int headIndex;
+    int length;
 
-        if (rand() % 10 == 0) {
-            symbol = '$';
-            color = LIGHT_YELLOW;
-            value = 50;
-        } else {
-            symbol = '*';
-            color = LIGHT_RED;
-            value = 10;
-        }
+    int capacity() const { return static_cast<int>(cells.size()); }
+    int slot(int i) const {
+        int s = headIndex + i;
+        return s >= capacity() ? s - capacity() : s;
     }
-    Position getPosition() const { return position; }
-    char getSymbol() const { return symbol; }
-    int getColor() const { return color; }
-    int getValue() const { return value; }
-};
 
-// ---------------------------- Snake ----------------------------
-class Snake {
-private:
-    std::vector<Position> body;
-    std::vector<Position> previousBody;
-    Direction direction;
-    bool growing;
 public:
-    Snake() : direction(STOP), growing(false) {
-        body.emplace_back(10, 10);
-        body.emplace_back(9, 10);
-        body.emplace_back(8, 10);
-        previousBody = body;
-    }
-
-    void setDirection(Direction dir) {
-        // Prevent immediate reverse
-        if ((direction == UP && dir != DOWN) ||
-            (direction == DOWN && dir != UP) ||
-            (direction == LEFT && dir != RIGHT) ||
-            (direction == RIGHT && dir != LEFT) ||
-            direction == STOP) {
-            direction = dir;
-        }
-    }
+    class const_iterator {
+    private:
+        const BodyRing* ring;
+        int index;
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = Position;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const Position*;
+        using reference = const Position&;
 
-    Direction getDirection() const { return direction; }
+        const_iterator(const BodyRing* r = nullptr, int i = 0) : ring(r), index(i) {}
+        reference operator*() const { return (*ring)[index]; }
+        pointer operator->() const { return &(*ring)[index]; }
+        const_iterator& operator++() { ++index; return *this; }
+        const_iterator operator++(int) { const_iterator tmp = *this; ++index; return tmp; }
+        bool operator==(const const_iterator& other) const { return index == other.index; }
+        bool operator!=(const const_iterator& other) const { return index != other.index; }
+    };
 
-    void move() {
-        if (direction == STOP) return;
-        previousBody = body;
-        Position head = body[0];
+    explicit BodyRing(int maxLength = 1)
+        : cells(std::max(1, maxLength)), headIndex(0), length(0) {}
 
-        switch (direction) {
-            case UP: head.y--; break;
-            case DOWN: head.y++; break;
-            case LEFT: head.x--; break;
-            case RIGHT: head.x++; break;
-            default: break;
-        }
+    void clear() { headIndex = 0; length = 0; }
 
-        body.insert(body.begin(), head);
-        if (!growing) {
-            body.pop_back();
-        } else {
-            growing = false;
-        }
+    void pushHead(const Position& pos) {
+        headIndex = headIndex == 0 ? capacity() - 1 : headIndex - 1;
+        cells[headIndex] = pos;
+        if (length < capacity()) length++;
     }
 
-    void grow() { growing = true; }
-    Position getHead() const { return body.empty() ? Position(0, 0) : body[0]; }
-    const std::vector<Position>& getBody() const { return body; }
-    const std::vector<Position>& getPreviousBody() const { return previousBody; }
+    void pushTail(const Position& pos) {
+        cells[slot(length)] = pos;
+        length++;
+    }
 
-    bool checkSelfCollision() const {
-        if (body.size() <= 1) return false;
-        Position head = body[0];
-        for (size_t i = 1; i < body.size(); i++) {
-            if (head == body[i]) return true;
-        }
-        return false;
+    Position popTail() {
+        length--;
+        return cells[slot(length)];
     }
 
-    int getLength() const { return static_cast<int>(body.size()); }
+    const Position& operator[](int i) const { return cells[slot(i)]; }
+    const Position& front() const { return cells[headIndex]; }
+    const Position& back() const { return (*this)[length - 1]; }
+    int size() const { return length; }
+    bool empty() const { return length == 0; }
+    bool full() const { return length == capacity(); }
 
-    void reset() {
-        body.clear();
-        body.emplace_back(10, 10);
-        body.emplace_back(9, 10);
-        body.emplace_back(8, 10);
-        previousBody = body;
-        direction = STOP;
-        growing = false;
+    // Doubles the capacity and keeps the segments, for owners that cannot
+    // size the ring up front (arena snakes); the single game never needs it.
+    void grow() {
+        std::vector<Position> bigger(cells.size() * 2);
+        for (int i = 0; i < length; i++) bigger[i] = (*this)[i];
+        cells.swap(bigger);
+        headIndex = 0;
     }
+
+    // The segments head first into out[0, size()), in at most two copies,
+    // and back; assign() puts the head in slot 0 and fails (changing
+    // nothing) when count exceeds the capacity.
+    void copyTo(Position* out) const {
+        int first = std::min(length, capacity() - headIndex);
+        std::memcpy(out, cells.data() + headIndex, static_cast<size_t>(first) * sizeof(Position));
+        std::memcpy(out + first, cells.data(), static_cast<size_t>(length - first) * sizeof(Position));
+    }
+    bool assign(const Position* in, int count) {
+        if (count < 0 || count > capacity()) return false;
+        std::memcpy(cells.data(), in, static_cast<size_t>(count) * sizeof(Position));
+        headIndex = 0;
+        length = count;
+        return true;
+    }
+
+    const_iterator begin() const { return const_iterator(this, 0); }
+    const_iterator end() const { return const_iterator(this, length); }
 };
 
-// ---------------------------- GameBoard (visual heavy) ----------------------------
-class GameBoard {
+// What changed on the board during one Snake::move().
+struct MoveDelta {
+    bool moved;
+    Position newHead;
+    bool tailVacated;
+    Position vacatedTail;
+    MoveDelta() : moved(false), newHead(0, 0), tailVacated(false), vacatedTail(0, 0) {}
+};
+
+// ---------------------------- Random Numbers ----------------------------
+// PCG32 (XSH-RR): 16 bytes of state, a few cycles per draw, and 2^63
+// independent streams selected at seeding time. Each simulation, batch
+// environment and runner task owns one, so runs are reproducible from a
+// single seed no matter how work is scheduled.
+class Pcg32 {
 private:
-    int width, height;
-    bool borderDrawn;
-    int lastScore;
-    int lastHighScore;
-    int lastLength;
-    std::string lastLevel;
-    bool wasPaused;
+    uint64_t state;
+    uint64_t increment;
 
 public:
-    GameBoard(int w = 30, int h = 20)
-        : width(w), height(h), borderDrawn(false),
-          lastScore(-1), lastHighScore(-1), lastLength(-1),
-          lastLevel(""), wasPaused(false) {}
-
-    int getWidth() const { return width; }
-    int getHeight() const { return height; }
+    typedef uint32_t result_type;
 
-    void drawBorder() {
-        if (borderDrawn) return;
-        Console::setColor(CYAN);
-        Console::gotoxy(0, 3);
-        std::cout << "+";
-        for (int i = 0; i < width; i++) std::cout << "-";
-        std::cout << "+";
+    explicit Pcg32(uint64_t seedValue = 0x853c49e6748fea9bULL, uint64_t stream = 0) {
+        seed(seedValue, stream);
+    }
 
-        for (int i = 0; i < height; i++) {
-            Console::gotoxy(0, 4 + i);
-            std::cout << "|";
-            Console::gotoxy(width + 1, 4 + i);
-            std::cout << "|";
-        }
+    void seed(uint64_t seedValue, uint64_t stream = 0) {
+        state = 0;
+        increment = (stream << 1) | 1;
+        next();
+        state += seedValue;
+        next();
+    }
 
-        Console::gotoxy(0, 4 + height);
-        std::cout << "+";
-        for (int i = 0; i < width; i++) std::cout << "-";
-        std::cout << "+";
-        borderDrawn = true;
+    uint32_t next() {
+        uint64_t old = state;
+        state = old * 6364136223846793005ULL + increment;
+        uint32_t xorshifted = static_cast<uint32_t>(((old >> 18) ^ old) >> 27);
+        uint32_t rot = static_cast<uint32_t>(old >> 59);
+        return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
     }
 
-    void drawSnake(const Snake& snake) {
-        const std::vector<Position>& currentBody = snake.getBody();
-        const std::vector<Position>& prevBody = snake.getPreviousBody();
-
-        for (const Position& pos : prevBody) {
-            if (std::find(currentBody.begin(), currentBody.end(), pos) == currentBody.end()) {
-                if (isValidPosition(pos)) {
-                    Console::gotoxy(pos.x + 1, pos.y + 4);
-                    std::cout << ' ';
-                }
+    // Uniform in [0, bound) without modulo bias (Lemire's multiply-shift,
+    // rejecting the few low products that would over-represent a value).
+    uint32_t nextBelow(uint32_t bound) {
+        uint64_t product = static_cast<uint64_t>(next()) * bound;
+        uint32_t low = static_cast<uint32_t>(product);
+        if (low < bound) {
+            uint32_t threshold = (0u - bound) % bound;
+            while (low < threshold) {
+                product = static_cast<uint64_t>(next()) * bound;
+                low = static_cast<uint32_t>(product);
             }
         }
+        return static_cast<uint32_t>(product >> 32);
+    }
 
-        if (!currentBody.empty()) {
-            Position head = currentBody[0];
-            if (isValidPosition(head)) {
-                Console::gotoxy(head.x + 1, head.y + 4);
-                Console::setColor(LIGHT_GREEN);
-                switch (snake.getDirection()) {
-                    case UP: std::cout << '^'; break;
-                    case DOWN: std::cout << 'v'; break;
-                    case LEFT: std::cout << '<'; break;
-                    case RIGHT: std::cout << '>'; break;
-                    default: std::cout << '@'; break;
-                }
-            }
-        }
+    // UniformRandomBitGenerator, for use with <random> and <algorithm>.
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return 0xFFFFFFFFu; }
+    result_type operator()() { return next(); }
+};
+
+// Fallback seed for runs without --seed.
+inline uint64_t clockSeed() {
+    uint64_t t = static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+    return t ^ (static_cast<uint64_t>(time(nullptr)) << 32);
+}
+
+// ---------------------------- Occupancy Grid ----------------------------
+inline int popCount64(uint64_t v) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcountll(v);
+#else
+    int n = 0;
+    for (; v; v &= v - 1) n++;
+    return n;
+#endif
+}
+
+inline int trailingZeros64(uint64_t v) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_ctzll(v);
+#else
+    int n = 0;
+    while (!(v & 1)) { v >>= 1; n++; }
+    return n;
+#endif
+}
+
+// Body cells per row, with a 64-way summary tree on top so a rank finds
+// its row in O(log height): after the height row counts come the sums of
+// every 64 rows, then of every 64 of those, and so on while a level has
+// more than 64 entries. Boards of up to 64 rows have no summary, and a
+// move costs one increment per level (three on a 2^27-cell board).
+static const int ROW_FANOUT = 64;
+
+inline size_t rowCountSize(int height) {
+    size_t total = static_cast<size_t>(height);
+    for (int n = height; n > ROW_FANOUT;) {
+        n = (n + ROW_FANOUT - 1) / ROW_FANOUT;
+        total += static_cast<size_t>(n);
+    }
+    return total;
+}
+
+inline void addRowUsed(int32_t* rowUsed, int height, int y, int delta) {
+    rowUsed[y] += delta;
+    for (int n = height; n > ROW_FANOUT;) {
+        rowUsed += n;
+        y /= ROW_FANOUT;
+        n = (n + ROW_FANOUT - 1) / ROW_FANOUT;
+        rowUsed[y] += delta;
+    }
+}
+
+// The rank-th free cell in row-major order of a padded bit grid, where
+// rowUsed holds the row counts and their summary (addRowUsed) and
+// bodyWord(y, i) returns word i of row y. The row is found level by level
+// down the summary, at most 64 entries a level, and the cell by popcount
+// over its words: O(log height + width / 64) with no per-cell index.
+template <typename BodyWord>
+Position selectFreeCell(int width, int height, int wordsPerRow, const int32_t* rowUsed,
+                        int rank, BodyWord bodyWord) {
+    // Where each level starts and how many entries and rows per entry it has.
+    const int32_t* level[8];
+    int entries[8];
+    int span[8];
+    int top = 0;
+    level[0] = rowUsed;
+    entries[0] = height;
+    span[0] = 1;
+    while (entries[top] > ROW_FANOUT) {
+        level[top + 1] = level[top] + entries[top];
+        entries[top + 1] = (entries[top] + ROW_FANOUT - 1) / ROW_FANOUT;
+        span[top + 1] = span[top] * ROW_FANOUT;
+        top++;
+    }
+    int y = 0;   // first entry of the current level's candidates
+    for (int k = top; k >= 0; k--) {
+        int last = std::min(entries[k], y + ROW_FANOUT);
+        for (; y < last - 1; y++) {
+            int rows = std::min(span[k], height - y * span[k]);
+            int freeInEntry = rows * width - level[k][y];
+            if (rank < freeInEntry) break;
+            rank -= freeInEntry;
+        }
+        if (k > 0) y *= ROW_FANOUT;
+    }
+    for (int i = 0; i < wordsPerRow; i++) {
+        int bits = std::min(64, width - i * 64);
+        uint64_t valid = bits == 64 ? ~uint64_t(0) : (uint64_t(1) << bits) - 1;
+        uint64_t freeBits = ~bodyWord(y, i) & valid;
+        int n = popCount64(freeBits);
+        if (rank >= n) {
+            rank -= n;
+            continue;
+        }
+        while (rank-- > 0) freeBits &= freeBits - 1;
+        return Position(i * 64 + trailingZeros64(freeBits), y);
+    }
+    return Position(0, y);
+}
+
+// What a board cell holds, in two bits.
+enum CellState { CELL_EMPTY = 0, CELL_BODY = 1, CELL_FOOD = 2, CELL_SPECIAL = 3 };
+
+// Two bits per board cell, as two bit planes (low and high bit of the
+// CellState) whose words are interleaved, so both bits of a cell share a
+// cache line. Rows are padded to whole 64-bit words so a row can be scanned
+// word by word; the body of a word is low & ~high. A 4096x4096 board is 4 MB.
+// Kept in step with the snake on every head push and tail pop, which makes
+// "is this cell taken" a single lookup.
+//
+// A per-row count of body cells (with its summary, see addRowUsed) replaces
+// a per-cell free list, so picking a random free cell is one draw plus a rank
+// select (selectFreeCell).
+class OccupancyGrid {
+private:
+    int width, height;
+    int wordsPerRow;
+    std::vector<uint64_t> planes;   // [2 * word] low bits, [2 * word + 1] high bits
+    std::vector<int32_t> rowUsed;
+    int bodyCount;
+
+    size_t wordIndex(const Position& pos) const {
+        return 2 * (static_cast<size_t>(pos.y) * wordsPerRow + (pos.x >> 6));
+    }
+    static uint64_t mask(const Position& pos) { return uint64_t(1) << (pos.x & 63); }
+
+    bool bodyBit(const Position& pos) const {
+        size_t w = wordIndex(pos);
+        return ((planes[w] & ~planes[w + 1]) & mask(pos)) != 0;
+    }
+
+    void write(const Position& pos, CellState state) {
+        size_t w = wordIndex(pos);
+        uint64_t m = mask(pos);
+        planes[w] = (state & 1) ? planes[w] | m : planes[w] & ~m;
+        planes[w + 1] = (state & 2) ? planes[w + 1] | m : planes[w + 1] & ~m;
+    }
+
+public:
+    OccupancyGrid(int w = 30, int h = 20)
+        : width(w), height(h), wordsPerRow((w + 63) / 64),
+          planes(2 * static_cast<size_t>(wordsPerRow) * h, 0),
+          rowUsed(rowCountSize(h), 0), bodyCount(0) {}
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    int getWordsPerRow() const { return wordsPerRow; }
+
+    // Word i of row y with a bit set for every body cell.
+    uint64_t bodyWord(int y, int i) const {
+        size_t w = 2 * (static_cast<size_t>(y) * wordsPerRow + i);
+        return planes[w] & ~planes[w + 1];
+    }
+
+    bool contains(const Position& pos) const {
+        return pos.x >= 0 && pos.x < width && pos.y >= 0 && pos.y < height;
+    }
+
+    CellState cellAt(const Position& pos) const {
+        if (!contains(pos)) return CELL_EMPTY;
+        size_t w = wordIndex(pos);
+        uint64_t m = mask(pos);
+        return static_cast<CellState>(((planes[w] & m) ? 1 : 0) | ((planes[w + 1] & m) ? 2 : 0));
+    }
+
+    // Cells outside the board are never occupied; walls are checked separately.
+    // Food does not occupy: the snake may move onto it.
+    bool isOccupied(const Position& pos) const {
+        return contains(pos) && bodyBit(pos);
+    }
+
+    bool isFree(const Position& pos) const {
+        return contains(pos) && !bodyBit(pos);
+    }
+
+    // Marks or unmarks food on a cell the body does not cover.
+    void setItem(const Position& pos, CellState item) {
+        if (isFree(pos)) write(pos, item == CELL_BODY ? CELL_EMPTY : item);
+    }
+
+    // Any food on the cell is replaced by the body.
+    void occupy(const Position& pos) {
+        if (!isFree(pos)) return;
+        write(pos, CELL_BODY);
+        addRowUsed(rowUsed.data(), height, pos.y, 1);
+        bodyCount++;
+    }
+
+    void release(const Position& pos) {
+        if (!isOccupied(pos)) return;
+        write(pos, CELL_EMPTY);
+        addRowUsed(rowUsed.data(), height, pos.y, -1);
+        bodyCount--;
+    }
+
+    void clear() {
+        std::fill(planes.begin(), planes.end(), 0);
+        std::fill(rowUsed.begin(), rowUsed.end(), 0);
+        bodyCount = 0;
+    }
+
+    int getFreeCount() const { return width * height - bodyCount; }
+
+    // The planes and row counts as raw bytes, for snapshots. Nothing reads
+    // them back: a loaded grid is rebuilt from the body.
+    size_t rawBytes() const { return planes.size() * sizeof(uint64_t) + rowUsed.size() * sizeof(int32_t); }
+    void copyTo(unsigned char* out) const {
+        std::memcpy(out, planes.data(), planes.size() * sizeof(uint64_t));
+        std::memcpy(out + planes.size() * sizeof(uint64_t), rowUsed.data(), rowUsed.size() * sizeof(int32_t));
+    }
+
+    // The rank-th cell not covered by the body, in row-major order.
+    Position freeCellAt(int rank) const {
+        return selectFreeCell(width, height, wordsPerRow, rowUsed.data(), rank,
+                              [this](int y, int i) { return bodyWord(y, i); });
+    }
+};
+
+// ---------------------------- Flood Fill ----------------------------
+// Which free cells can the head still get to, and is the tail among them?
+// Answered on the packed grid, 64 cells per word operation: the seeds of a
+// row grow through the free run they sit in with Kogge-Stone steps (shift
+// by 1, 2, 4 ... 32, each doubling how far a seed has spread), carried
+// across word boundaries. A row that grew hands the words that changed to
+// the rows above and below, from a work stack, so a one-cell corridor
+// costs a word per row instead of a sweep of the board. Buffers are kept
+// between calls: a fill allocates only when the board grows.
+class FloodFill {
+private:
+    // Row y takes in what row from reached in words [lo, hi].
+    struct RowSpan {
+        int y, from, lo, hi;
+    };
+
+    int width, height, wordsPerRow;
+    std::vector<uint64_t> open;      // free cells, padding bits clear
+    std::vector<uint64_t> reached;
+    std::vector<RowSpan> work;
+
+    // Occluded fills: seeds spread toward higher (or lower) bits as long as
+    // the cells on the way are in run.
+    static uint64_t spreadUp(uint64_t seed, uint64_t run) {
+        seed |= run & (seed << 1);  run &= run << 1;
+        seed |= run & (seed << 2);  run &= run << 2;
+        seed |= run & (seed << 4);  run &= run << 4;
+        seed |= run & (seed << 8);  run &= run << 8;
+        seed |= run & (seed << 16); run &= run << 16;
+        return seed | (run & (seed << 32));
+    }
+    static uint64_t spreadDown(uint64_t seed, uint64_t run) {
+        seed |= run & (seed >> 1);  run &= run >> 1;
+        seed |= run & (seed >> 2);  run &= run >> 2;
+        seed |= run & (seed >> 4);  run &= run >> 4;
+        seed |= run & (seed >> 8);  run &= run >> 8;
+        seed |= run & (seed >> 16); run &= run >> 16;
+        return seed | (run & (seed >> 32));
+    }
+
+    // Fills the free runs through the new seeds in words [lo, hi] of row y,
+    // following carries past either end while they add cells, and queues
+    // the neighbouring rows for the words that changed.
+    void growRow(int y, int lo, int hi) {
+        uint64_t* r = &reached[static_cast<size_t>(y) * wordsPerRow];
+        const uint64_t* o = &open[static_cast<size_t>(y) * wordsPerRow];
+        uint64_t carry = 0;
+        int i = lo;
+        for (; i < wordsPerRow && (i <= hi || (carry & o[i] & ~r[i])); i++) {
+            r[i] = spreadUp(r[i] | (carry & o[i]), o[i]);
+            carry = r[i] >> 63;
+        }
+        hi = i - 1;
+        carry = 0;
+        for (i = hi; i >= 0 && (i >= lo || ((carry << 63) & o[i] & ~r[i])); i--) {
+            r[i] = spreadDown(r[i] | ((carry << 63) & o[i]), o[i]);
+            carry = r[i] & 1;
+        }
+        lo = i + 1;
+        if (y > 0 && feeds(y - 1, y, lo, hi)) work.push_back(RowSpan{ y - 1, y, lo, hi });
+        if (y + 1 < height && feeds(y + 1, y, lo, hi)) work.push_back(RowSpan{ y + 1, y, lo, hi });
+    }
+
+    // Whether row from has reached cells over open, unreached ones of row
+    // y. Checked before queueing, so a corridor does not pile up spans
+    // pointing back the way the fill came.
+    bool feeds(int y, int from, int lo, int hi) const {
+        const uint64_t* r = &reached[static_cast<size_t>(y) * wordsPerRow];
+        const uint64_t* src = &reached[static_cast<size_t>(from) * wordsPerRow];
+        const uint64_t* o = &open[static_cast<size_t>(y) * wordsPerRow];
+        for (int i = lo; i <= hi; i++) {
+            if (src[i] & o[i] & ~r[i]) return true;
+        }
+        return false;
+    }
+
+    bool isSet(const std::vector<uint64_t>& bits, const Position& p) const {
+        return (bits[static_cast<size_t>(p.y) * wordsPerRow + (p.x >> 6)] >> (p.x & 63)) & 1;
+    }
+    void set(std::vector<uint64_t>& bits, const Position& p) {
+        bits[static_cast<size_t>(p.y) * wordsPerRow + (p.x >> 6)] |= uint64_t(1) << (p.x & 63);
+    }
+    bool inside(const Position& p) const { return p.x >= 0 && p.x < width && p.y >= 0 && p.y < height; }
+
+public:
+    FloodFill() : width(0), height(0), wordsPerRow(0) {}
+
+    // Spreads from `from` (which may be taken, like the head) through the
+    // cells bodyWord(y, i) leaves clear, plus alsoOpen when it is on the
+    // board (the tail, which moves off next tick). Stops early once
+    // stopAt is reached, if it is on the board. Returns the number of open
+    // cells reached.
+    template <typename BodyWord>
+    int fill(int w, int h, int stride, BodyWord bodyWord, const Position& from,
+             const Position& alsoOpen = Position(-1, -1), const Position& stopAt = Position(-1, -1)) {
+        width = w;
+        height = h;
+        wordsPerRow = stride;
+        size_t words = static_cast<size_t>(h) * stride;
+        if (open.size() < words) {
+            open.resize(words);
+            reached.resize(words);
+            work.reserve(4 * static_cast<size_t>(h) + 16);
+        }
+        for (int y = 0; y < h; y++) {
+            for (int i = 0; i < stride; i++) {
+                int bits = std::min(64, w - i * 64);
+                uint64_t valid = bits == 64 ? ~uint64_t(0) : (uint64_t(1) << bits) - 1;
+                open[static_cast<size_t>(y) * stride + i] = ~bodyWord(y, i) & valid;
+            }
+        }
+        std::fill(reached.begin(), reached.begin() + words, 0);
+        if (!inside(from)) return 0;
+        if (inside(alsoOpen)) set(open, alsoOpen);
+        bool early = inside(stopAt);
+
+        work.clear();
+        set(reached, from);
+        growRow(from.y, from.x >> 6, from.x >> 6);
+        while (!work.empty() && !(early && isSet(reached, stopAt))) {
+            RowSpan span = work.back();
+            work.pop_back();
+            uint64_t* r = &reached[static_cast<size_t>(span.y) * stride];
+            const uint64_t* src = &reached[static_cast<size_t>(span.from) * stride];
+            const uint64_t* o = &open[static_cast<size_t>(span.y) * stride];
+            int lo = span.hi + 1, hi = span.lo - 1;
+            for (int i = span.lo; i <= span.hi; i++) {
+                uint64_t added = src[i] & o[i] & ~r[i];
+                if (!added) continue;
+                r[i] |= added;
+                lo = std::min(lo, i);
+                hi = i;
+            }
+            if (lo <= hi) growRow(span.y, lo, hi);
+        }
+
+        int count = 0;
+        for (size_t i = 0; i < words; i++) count += popCount64(reached[i] & open[i]);
+        return count;
+    }
+
+    int fill(const OccupancyGrid& grid, const Position& from,
+             const Position& alsoOpen = Position(-1, -1), const Position& stopAt = Position(-1, -1)) {
+        return fill(grid.getWidth(), grid.getHeight(), grid.getWordsPerRow(),
+                    [&grid](int y, int i) { return grid.bodyWord(y, i); }, from, alsoOpen, stopAt);
+    }
+
+    // Whether the last fill got to p.
+    bool isReached(const Position& p) const { return inside(p) && isSet(reached, p); }
+};
+
+// ---------------------------- Food ----------------------------
+class Food {
+private:
+    Position position;
+    char symbol;
+    int color;
+    int value;
+    bool available;
+public:
+    Food() : position(0, 0), symbol('*'), color(LIGHT_RED), value(10), available(false) {}
+
+    // Places food on a random free cell and marks it in the grid. Returns
+    // false when the snake covers the whole board and there is nowhere left
+    // to put it.
+    bool generateFood(OccupancyGrid& grid, Pcg32& rng, int specialPercent = 10) {
+        if (available) grid.setItem(position, CELL_EMPTY);
+        int freeCount = grid.getFreeCount();
+        if (freeCount == 0) {
+            available = false;
+            return false;
+        }
+        position = grid.freeCellAt(static_cast<int>(rng.nextBelow(static_cast<uint32_t>(freeCount))));
+        available = true;
+
+        if (static_cast<int>(rng.nextBelow(100)) < specialPercent) {
+            symbol = '$';
+            color = LIGHT_YELLOW;
+            value = 50;
+        } else {
+            symbol = '*';
+            color = LIGHT_RED;
+            value = 10;
+        }
+        grid.setItem(position, value == 50 ? CELL_SPECIAL : CELL_FOOD);
+        return true;
+    }
+    Position getPosition() const { return position; }
+    bool isAvailable() const { return available; }
+    char getSymbol() const { return symbol; }
+    int getColor() const { return color; }
+    int getValue() const { return value; }
+
+    // Shows food that another process placed (a spectator's mirror); no
+    // grid is involved.
+    void place(const Position& pos, bool special) {
+        position = pos;
+        available = true;
+        symbol = special ? '$' : '*';
+        color = special ? LIGHT_YELLOW : LIGHT_RED;
+        value = special ? 50 : 10;
+    }
+    void remove() { available = false; }
+};
+
+// ---------------------------- Snake ----------------------------
+class Snake {
+private:
+    BodyRing body;
+    OccupancyGrid occupancy;
+    MoveDelta lastMove;
+    Direction direction;
+    bool growing;
+    bool collided;
+
+    // Three cells in the middle of the board, tail to the left.
+    void placeAtStart() {
+        body.clear();
+        occupancy.clear();
+        Position start = startPosition(occupancy.getWidth(), occupancy.getHeight());
+        for (int i = 0; i < 3; i++) {
+            body.pushTail(Position(start.x - i, start.y));
+            occupancy.occupy(Position(start.x - i, start.y));
+        }
+        lastMove = MoveDelta();
+        collided = false;
+    }
+
+public:
+    static Position startPosition(int boardWidth, int boardHeight) {
+        return Position(boardWidth / 2, boardHeight / 2);
+    }
+
+    // The buffer holds every cell of the board plus one, so the head can be
+    // pushed before the tail is popped even when the snake fills the board.
+    Snake(int boardWidth = 30, int boardHeight = 20)
+        : body(boardWidth * boardHeight + 1), occupancy(boardWidth, boardHeight),
+          direction(STOP), growing(false), collided(false) {
+        placeAtStart();
+    }
+
+    void setDirection(Direction dir) {
+        // Prevent immediate reverse
+        if ((direction == UP && dir != DOWN) ||
+            (direction == DOWN && dir != UP) ||
+            (direction == LEFT && dir != RIGHT) ||
+            (direction == RIGHT && dir != LEFT) ||
+            direction == STOP) {
+            direction = dir;
+        }
+    }
+
+    Direction getDirection() const { return direction; }
+
+    // Direct body edits for tools that set up or mirror a position (the
+    // benchmarks, spectators): no rules and no collision test.
+    void clearBody() {
+        body.clear();
+        occupancy.clear();
+        lastMove = MoveDelta();
+        growing = false;
+        collided = false;
+    }
+    void pushHead(const Position& pos) {
+        body.pushHead(pos);
+        occupancy.occupy(pos);
+    }
+    Position popTail() {
+        Position tail = body.popTail();
+        occupancy.release(tail);
+        return tail;
+    }
+    void forceDirection(Direction dir) { direction = dir; }
+
+    // A move made elsewhere, with the bookkeeping of move() so that
+    // GameBoard::drawSnake draws it incrementally.
+    const MoveDelta& mirrorMove(const Position& head, bool tailLeaves) {
+        lastMove = MoveDelta();
+        if (tailLeaves) {
+            lastMove.tailVacated = true;
+            lastMove.vacatedTail = popTail();
+        }
+        pushHead(head);
+        lastMove.moved = true;
+        lastMove.newHead = head;
+        return lastMove;
+    }
+
+    const MoveDelta& move() {
+        lastMove = MoveDelta();
+        if (direction == STOP) return lastMove;
+        Position head = body.front();
+
+        switch (direction) {
+            case UP: head.y--; break;
+            case DOWN: head.y++; break;
+            case LEFT: head.x--; break;
+            case RIGHT: head.x++; break;
+            default: break;
+        }
+
+        // Into the wall: the move is reported but the body stays where it
+        // was, so the head never leaves the board.
+        if (!occupancy.contains(head)) {
+            lastMove.moved = true;
+            lastMove.newHead = head;
+            return lastMove;
+        }
+
+        // Free the tail first: moving into the cell it just left is legal.
+        if (!growing) {
+            lastMove.tailVacated = true;
+            lastMove.vacatedTail = body.popTail();
+            occupancy.release(lastMove.vacatedTail);
+        } else {
+            growing = false;
+        }
+
+        collided = occupancy.isOccupied(head);
+        body.pushHead(head);
+        occupancy.occupy(head);
+        lastMove.moved = true;
+        lastMove.newHead = head;
+        return lastMove;
+    }
+
+    void grow() { growing = true; }
+    Position getHead() const { return body.empty() ? Position(0, 0) : body.front(); }
+    const BodyRing& getBody() const { return body; }
+    const MoveDelta& getLastMove() const { return lastMove; }
+
+    const OccupancyGrid& getOccupancy() const { return occupancy; }
+    // Writable for placing food; the body bits belong to the snake.
+    OccupancyGrid& getOccupancy() { return occupancy; }
+
+    // Set by move() when the new head landed on a cell the body still held.
+    bool checkSelfCollision() const { return collided; }
+
+    int getLength() const { return body.size(); }
+
+    void reset() {
+        placeAtStart();
+        direction = STOP;
+        growing = false;
+    }
+
+    // Flat form for SimulationSnapshot: the fields below, the body head
+    // first, then the grid; snapshotBytes() is what save() writes. The
+    // first four are MoveDelta's; flags and the direction are stored as
+    // plain integers, since a file may hold any byte there.
+    struct Fixed {
+        uint8_t moved;
+        Position newHead;
+        uint8_t tailVacated;
+        Position vacatedTail;
+        int32_t direction;
+        int32_t length;
+        uint8_t growing;
+        uint8_t collided;
+    };
+
+    size_t snapshotBytes() const {
+        return sizeof(Fixed) + static_cast<size_t>(body.size()) * sizeof(Position) + occupancy.rawBytes();
+    }
+
+    void save(unsigned char* out) const {
+        // Padding zeroed too, so equal states save equal bytes.
+        Fixed fixed;
+        std::memset(static_cast<void*>(&fixed), 0, sizeof(fixed));
+        fixed.moved = lastMove.moved;
+        fixed.newHead = lastMove.newHead;
+        fixed.tailVacated = lastMove.tailVacated;
+        fixed.vacatedTail = lastMove.vacatedTail;
+        fixed.direction = direction;
+        fixed.length = body.size();
+        fixed.growing = growing;
+        fixed.collided = collided;
+        std::memcpy(out, &fixed, sizeof(fixed));
+        body.copyTo(reinterpret_cast<Position*>(out + sizeof(fixed)));
+        occupancy.copyTo(out + sizeof(fixed) + static_cast<size_t>(fixed.length) * sizeof(Position));
+    }
+
+    // Reads what save() wrote on a board of this size, rebuilding the grid
+    // from the body and marking `food` on it; false, changing nothing, when
+    // `size` bytes are not that or the body leaves the board, breaks,
+    // crosses itself or covers the food. Games that ended are never saved,
+    // so a saved head is always on a free cell.
+    bool load(const unsigned char* in, size_t size, const Food& food) {
+        Fixed fixed;
+        if (size < sizeof(fixed)) return false;
+        std::memcpy(&fixed, in, sizeof(fixed));
+        if (fixed.length < 1 || fixed.direction < UP || fixed.direction > STOP || fixed.moved > 1 ||
+            fixed.tailVacated > 1 || fixed.growing > 1 || fixed.collided > 1 ||
+            size != sizeof(fixed) + static_cast<size_t>(fixed.length) * sizeof(Position) + occupancy.rawBytes()) {
+            return false;
+        }
+        const Position* cells = reinterpret_cast<const Position*>(in + sizeof(fixed));
+        OccupancyGrid grid(occupancy.getWidth(), occupancy.getHeight());
+        for (int i = 0; i < fixed.length; i++) {
+            if (!grid.isFree(cells[i])) return false;
+            if (i > 0 && std::abs(cells[i].x - cells[i - 1].x) + std::abs(cells[i].y - cells[i - 1].y) != 1) {
+                return false;
+            }
+            grid.occupy(cells[i]);
+        }
+        if (food.isAvailable()) {
+            if (!grid.isFree(food.getPosition())) return false;
+            grid.setItem(food.getPosition(), food.getValue() == 50 ? CELL_SPECIAL : CELL_FOOD);
+        }
+        if ((fixed.moved && !(fixed.newHead == cells[0])) ||
+            (fixed.tailVacated && !grid.contains(fixed.vacatedTail)) || !body.assign(cells, fixed.length)) {
+            return false;
+        }
+        occupancy = std::move(grid);
+        lastMove = MoveDelta();
+        lastMove.moved = fixed.moved != 0;
+        lastMove.newHead = fixed.newHead;
+        lastMove.tailVacated = fixed.tailVacated != 0;
+        lastMove.vacatedTail = fixed.vacatedTail;
+        direction = static_cast<Direction>(fixed.direction);
+        growing = fixed.growing != 0;
+        collided = fixed.collided != 0;
+        return true;
+    }
+};
+
+// ---------------------------- Simulation ----------------------------
+// The body ring takes 8 bytes per cell, so this caps one game near 1 GB.
+static const long long MAX_BOARD_CELLS = 1LL << 27;
+
+// Board size, food odds and the speed curve. The defaults are the classic
+// interactive game.
+struct SimulationConfig {
+    int width;
+    int height;
+    int specialFoodPercent;   // chance that a new food is the '$' bonus
+    int pointsPerLevel;
+    int baseTickMs;           // tick period is baseTickMs - level * tickMsPerLevel,
+    int tickMsPerLevel;       // never below minTickMs
+    int minTickMs;
+
+    SimulationConfig(int w = 30, int h = 20)
+        : width(w), height(h), specialFoodPercent(10), pointsPerLevel(100),
+          baseTickMs(200), tickMsPerLevel(15), minTickMs(50) {}
+
+    // What the game can run: a board of 4x1 up to MAX_BOARD_CELLS, levels
+    // that advance, and a tick period of at least 1 ms. Every config read
+    // from a file is checked with this.
+    bool isValid() const {
+        return width >= 4 && height >= 1 && static_cast<long long>(width) * height <= MAX_BOARD_CELLS &&
+               specialFoodPercent >= 0 && specialFoodPercent <= 100 && pointsPerLevel >= 1 &&
+               minTickMs >= 1 && baseTickMs >= 0 && tickMsPerLevel >= 0;
+    }
+
+    bool operator==(const SimulationConfig& o) const {
+        return width == o.width && height == o.height && specialFoodPercent == o.specialFoodPercent &&
+               pointsPerLevel == o.pointsPerLevel && baseTickMs == o.baseTickMs &&
+               tickMsPerLevel == o.tickMsPerLevel && minTickMs == o.minTickMs;
+    }
+};
+
+enum StepOutcome { STEP_IDLE, STEP_MOVED, STEP_ATE, STEP_DIED, STEP_WON };
+
+// A whole SimulationState, random generator included, as one block of
+// plain bytes: a Header, then Snake::save()'s fields, body and grid. Copying
+// a snapshot is one memcpy and no pointer is inside, so tree searches can
+// clone states freely and a save-game is the block written to a file (read
+// back by the same build). Taking snapshot after snapshot into one object
+// stops allocating once it has held the longest snake.
+class SimulationSnapshot {
+public:
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        uint64_t bytes;               // the whole snapshot
+        SimulationConfig config;
+        Pcg32 rng;
+        // Food's fields in its order; like the flags below, the flag is a
+        // byte, since the file may hold any value there.
+        struct {
+            Position position;
+            char symbol;
+            int color;
+            int value;
+            uint8_t available;
+        } food;
+        int score;
+        int level;
+        int tickMs;
+        long long ticks;
+        Position eatenFoodPos;
+        uint8_t over;
+        uint8_t won;
+        uint8_t foodEaten;
+    };
+    static_assert(std::is_trivially_copyable<Header>::value, "snapshot headers are copied as bytes");
+
+    static const uint32_t VERSION = 1;
+
+private:
+    std::vector<uint64_t> words;   // whole words keep the body and grid aligned
+    size_t bytes;
+
+public:
+    SimulationSnapshot() : bytes(0) {}
+
+    const unsigned char* data() const { return reinterpret_cast<const unsigned char*>(words.data()); }
+    size_t size() const { return bytes; }
+
+    // Room for n bytes, keeping the buffer when it is already big enough.
+    unsigned char* prepare(size_t n) {
+        words.resize((n + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+        bytes = n;
+        return reinterpret_cast<unsigned char*>(words.data());
+    }
+
+    // The header, or false when these bytes are not a snapshot.
+    bool header(Header& out) const {
+        if (bytes < sizeof(Header)) return false;
+        std::memcpy(static_cast<void*>(&out), data(), sizeof(Header));
+        return std::memcmp(out.magic, "SNKG", 4) == 0 && out.version == VERSION && out.bytes == bytes;
+    }
+
+    bool writeFile(const std::string& path) const {
+        FILE* file = std::fopen(path.c_str(), "wb");
+        if (!file) return false;
+        bool ok = std::fwrite(data(), 1, bytes, file) == bytes;
+        return std::fclose(file) == 0 && ok;
+    }
+
+    bool readFile(const std::string& path) {
+        FILE* file = std::fopen(path.c_str(), "rb");
+        if (!file) return false;
+        bool ok = std::fseek(file, 0, SEEK_END) == 0;
+        long length = ok ? std::ftell(file) : -1;
+        ok = length >= 0 && std::fseek(file, 0, SEEK_SET) == 0;
+        if (ok) {
+            unsigned char* blob = prepare(static_cast<size_t>(length));
+            ok = std::fread(blob, 1, bytes, file) == bytes;
+        }
+        std::fclose(file);
+        Header check;
+        return ok && header(check);
+    }
+};
+
+// The game rules with no I/O: move, grow, collide, score and level up.
+// Each instance owns its random generator, so any number of them can run
+// side by side, as fast as the CPU allows.
+class SimulationState {
+private:
+    SimulationConfig config;
+    Snake snake;
+    Food food;
+    Pcg32 rng;
+    int score;
+    int level;
+    int tickMs;
+    long long ticks;
+    bool over;
+    bool won;
+    bool foodEaten;
+    Position eatenFoodPos;
+
+    void updateGameSpeed() {
+        level = score / config.pointsPerLevel + 1;
+        tickMs = std::max(config.minTickMs, config.baseTickMs - level * config.tickMsPerLevel);
+    }
+
+public:
+    explicit SimulationState(const SimulationConfig& cfg = SimulationConfig(),
+                             uint64_t seed = 0, uint64_t stream = 0)
+        : config(cfg), snake(cfg.width, cfg.height), rng(seed, stream),
+          score(0), level(1), tickMs(cfg.baseTickMs), ticks(0),
+          over(false), won(false), foodEaten(false), eatenFoodPos(0, 0) {
+        reset();
+    }
+
+    void reset() {
+        snake.reset();
+        score = 0;
+        ticks = 0;
+        over = false;
+        won = false;
+        foodEaten = false;
+        updateGameSpeed();
+        food.generateFood(snake.getOccupancy(), rng, config.specialFoodPercent);
+    }
+
+    // Takes effect from the next food spawn; call reset() to start a fresh,
+    // reproducible episode from this seed.
+    void seed(uint64_t value, uint64_t stream = 0) { rng.seed(value, stream); }
+
+    // Advances one tick. STOP keeps the current heading; a turn straight back
+    // into the body is ignored, as it is for the keyboard.
+    StepOutcome step(Direction action) {
+        if (over) return won ? STEP_WON : STEP_DIED;
+        foodEaten = false;
+        if (action != STOP) snake.setDirection(action);
+
+        const MoveDelta& delta = snake.move();
+        updateGameSpeed();
+        if (!delta.moved) return STEP_IDLE;
+        ticks++;
+
+        Position head = delta.newHead;
+        if (!snake.getOccupancy().contains(head) || snake.checkSelfCollision()) {
+            over = true;
+            return STEP_DIED;
+        }
+
+        if (head == food.getPosition()) {
+            score += food.getValue();
+            snake.grow();
+            foodEaten = true;
+            eatenFoodPos = head;
+            if (!food.generateFood(snake.getOccupancy(), rng, config.specialFoodPercent)) {
+                // The snake fills the whole board: nothing left to eat.
+                won = true;
+                over = true;
+                return STEP_WON;
+            }
+            return STEP_ATE;
+        }
+        return STEP_MOVED;
+    }
+
+    // Everything into `out`; restore() from it carries on exactly from here.
+    void snapshot(SimulationSnapshot& out) const {
+        SimulationSnapshot::Header header;
+        std::memset(static_cast<void*>(&header), 0, sizeof(header));
+        std::memcpy(header.magic, "SNKG", 4);
+        header.version = SimulationSnapshot::VERSION;
+        header.bytes = sizeof(header) + snake.snapshotBytes();
+        header.config = config;
+        header.rng = rng;
+        header.food.position = food.getPosition();
+        header.food.symbol = food.getSymbol();
+        header.food.color = food.getColor();
+        header.food.value = food.getValue();
+        header.food.available = food.isAvailable();
+        header.score = score;
+        header.level = level;
+        header.tickMs = tickMs;
+        header.ticks = ticks;
+        header.eatenFoodPos = eatenFoodPos;
+        header.over = over;
+        header.won = won;
+        header.foodEaten = foodEaten;
+        unsigned char* blob = out.prepare(header.bytes);
+        std::memcpy(blob, &header, sizeof(header));
+        snake.save(blob + sizeof(header));
+    }
+
+    // False, changing nothing, unless `in` is a snapshot of a game in
+    // progress on a board of this size.
+    bool restore(const SimulationSnapshot& in) {
+        SimulationSnapshot::Header header;
+        if (!in.header(header) || !header.config.isValid() || header.config.width != config.width ||
+            header.config.height != config.height || header.over || header.won || header.score < 0 ||
+            header.level < 0 || header.tickMs < 1 || header.ticks < 0 ||
+            header.foodEaten > 1 || header.food.available > 1 ||
+            (header.foodEaten && !snake.getOccupancy().contains(header.eatenFoodPos))) {
+            return false;
+        }
+        // Only the position is taken from the file; the rest follows from
+        // the value, as generateFood() sets it.
+        Food saved;
+        if (header.food.available) saved.place(header.food.position, header.food.value == 50);
+        if (!snake.load(in.data() + sizeof(header), in.size() - sizeof(header), saved)) return false;
+        config = header.config;
+        rng = header.rng;
+        food = saved;
+        score = header.score;
+        level = header.level;
+        tickMs = header.tickMs;
+        ticks = header.ticks;
+        eatenFoodPos = header.eatenFoodPos;
+        over = false;
+        won = false;
+        foodEaten = header.foodEaten != 0;
+        return true;
+    }
+
+    const SimulationConfig& getConfig() const { return config; }
+    const Snake& getSnake() const { return snake; }
+    const Food& getFood() const { return food; }
+    int getLength() const { return snake.getLength(); }
+    int getScore() const { return score; }
+    int getLevel() const { return level; }
+    int getTickMs() const { return tickMs; }
+    long long getTicks() const { return ticks; }
+    bool isOver() const { return over; }
+    bool hasWon() const { return won; }
+    bool wasFoodEaten() const { return foodEaten; }
+    Position getEatenFoodPosition() const { return eatenFoodPos; }
+};
+
+// ---------------------------- Fixed-Size Simulation ----------------------------
+// Rules for FixedSimulation, fixed at compile time. ClassicRules is
+// SimulationConfig's default game; derive from it to change one thing.
+struct ClassicRules {
+    static constexpr bool WRAP_WALLS = false;   // leaving one edge enters at the opposite one
+    static constexpr int SPECIAL_FOOD_PERCENT = 10;
+    static constexpr int POINTS_PER_LEVEL = 100;
+    static constexpr int BASE_TICK_MS = 200;
+    static constexpr int TICK_MS_PER_LEVEL = 15;   // 0 keeps the speed fixed
+    static constexpr int MIN_TICK_MS = 50;
+};
+
+struct WrapRules : ClassicRules {
+    static constexpr bool WRAP_WALLS = true;
+};
+
+struct FixedSpeedRules : ClassicRules {
+    static constexpr int TICK_MS_PER_LEVEL = 0;
+};
+
+// SimulationState with the board size and rules as template arguments, for
+// training on one configuration. Cells are flat row-major indices, the body
+// is a one-bit-per-cell set of WORDS words and the ring length is a power of
+// two, so bounds, indexing and wrap-around compile to constants and masks
+// and the free-cell select is a fixed loop over a few words. Nothing is on
+// the heap: a copy is a memcpy. With ClassicRules it draws from its random
+// generator exactly as SimulationState does, so equal seeds and actions
+// give equal games; other sizes and rules use the runtime SimulationState.
+template <int W, int H, typename Rules = ClassicRules>
+class FixedSimulation {
+public:
+    static_assert(W >= 4 && H >= 1 && W * H <= 65535, "cells must fit 16-bit indices");
+
+    static constexpr int CELLS = W * H;
+    static constexpr int WORDS = (CELLS + 63) / 64;
+
+    static constexpr bool inBounds(int x, int y) {
+        return static_cast<unsigned>(x) < static_cast<unsigned>(W) &&
+               static_cast<unsigned>(y) < static_cast<unsigned>(H);
+    }
+    static constexpr int cellIndex(int x, int y) { return y * W + x; }
+
+private:
+    static constexpr int ringSize(int n) { return n <= 1 ? 1 : 2 * ringSize((n + 1) / 2); }
+    static constexpr int RING = ringSize(CELLS + 1);
+    static constexpr uint64_t LAST_WORD_MASK =
+        CELLS % 64 == 0 ? ~uint64_t(0) : (uint64_t(1) << (CELLS % 64)) - 1;
+
+    std::array<uint64_t, WORDS> body;
+    std::array<uint16_t, RING> ring;   // body cells, head at ring[headSlot]
+    Pcg32 rng;
+    int headSlot;
+    int length;
+    int headX, headY;
+    int foodCell;
+    bool foodSpecial;
+    Direction direction;
+    bool growing;
+    int score;
+    int level;
+    int tickMs;
+    long long ticks;
+    bool over;
+    bool won;
+    bool foodEaten;
+
+    bool bodyBit(int cell) const { return (body[cell >> 6] >> (cell & 63)) & 1; }
+
+    void pushHead(int cell, bool mark) {
+        headSlot = (headSlot + 1) & (RING - 1);
+        ring[headSlot] = static_cast<uint16_t>(cell);
+        length++;
+        body[cell >> 6] |= static_cast<uint64_t>(mark) << (cell & 63);
+    }
+
+    void popTail() {
+        int cell = ring[(headSlot - length + 1) & (RING - 1)];
+        body[cell >> 6] &= ~(uint64_t(1) << (cell & 63));
+        length--;
+    }
+
+    void updateGameSpeed() {
+        level = score / Rules::POINTS_PER_LEVEL + 1;
+        tickMs = std::max(Rules::MIN_TICK_MS, Rules::BASE_TICK_MS - level * Rules::TICK_MS_PER_LEVEL);
+    }
+
+    // The rank-th cell the body does not cover, as Food::generateFood picks it.
+    int freeCellAt(int rank) const {
+        for (int i = 0; i < WORDS; i++) {
+            uint64_t freeBits = ~body[i] & (i == WORDS - 1 ? LAST_WORD_MASK : ~uint64_t(0));
+            int n = popCount64(freeBits);
+            if (rank >= n) {
+                rank -= n;
+                continue;
+            }
+            while (rank-- > 0) freeBits &= freeBits - 1;
+            return i * 64 + trailingZeros64(freeBits);
+        }
+        return 0;
+    }
+
+    bool placeFood() {
+        int freeCount = CELLS - length;
+        if (freeCount == 0) {
+            foodCell = -1;
+            return false;
+        }
+        foodCell = freeCellAt(static_cast<int>(rng.nextBelow(static_cast<uint32_t>(freeCount))));
+        foodSpecial = static_cast<int>(rng.nextBelow(100)) < Rules::SPECIAL_FOOD_PERCENT;
+        return true;
+    }
+
+public:
+    explicit FixedSimulation(uint64_t seed = 0, uint64_t stream = 0) : rng(seed, stream) { reset(); }
+
+    void reset() {
+        body.fill(0);
+        headSlot = RING - 1;
+        length = 0;
+        Position start = Snake::startPosition(W, H);
+        for (int i = 2; i >= 0; i--) pushHead(cellIndex(start.x - i, start.y), true);
+        headX = start.x;
+        headY = start.y;
+        direction = STOP;
+        growing = false;
+        score = 0;
+        ticks = 0;
+        over = false;
+        won = false;
+        foodEaten = false;
+        updateGameSpeed();
+        placeFood();
+    }
+
+    void seed(uint64_t value, uint64_t stream = 0) { rng.seed(value, stream); }
+
+    // SimulationState::step, with the same outcomes.
+    StepOutcome step(Direction action) {
+        static const int dx[5] = { 0, 0, -1, 1, 0 };
+        static const int dy[5] = { -1, 1, 0, 0, 0 };
+        if (over) return won ? STEP_WON : STEP_DIED;
+        foodEaten = false;
+        if (action != STOP && !isReverse(direction, action)) direction = action;
+        updateGameSpeed();
+        if (direction == STOP) return STEP_IDLE;
+        ticks++;
+
+        int x = headX + dx[direction];
+        int y = headY + dy[direction];
+        if (Rules::WRAP_WALLS) {
+            x += (x < 0) * W - (x >= W) * W;
+            y += (y < 0) * H - (y >= H) * H;
+        }
+        bool inside = inBounds(x, y);
+        int cell = inside ? cellIndex(x, y) : 0;
+
+        // Free the tail first: moving into the cell it just left is legal.
+        if (!growing) popTail();
+        growing = false;
+        bool hit = !inside || bodyBit(cell);
+        pushHead(cell, inside);
+        headX = x;
+        headY = y;
+        if (hit) {
+            over = true;
+            return STEP_DIED;
+        }
+
+        if (cell == foodCell) {
+            score += foodSpecial ? 50 : 10;
+            growing = true;
+            foodEaten = true;
+            if (!placeFood()) {
+                won = true;
+                over = true;
+                return STEP_WON;
+            }
+            return STEP_ATE;
+        }
+        return STEP_MOVED;
+    }
+
+    // For policies: on the board (after wrapping, under WRAP_WALLS) and not
+    // under the body. Food cells are free.
+    bool isFree(Position p) const {
+        if (Rules::WRAP_WALLS) {
+            p.x += (p.x < 0) * W - (p.x >= W) * W;
+            p.y += (p.y < 0) * H - (p.y >= H) * H;
+        }
+        return inBounds(p.x, p.y) && !bodyBit(cellIndex(p.x, p.y));
+    }
+
+    // Segment i of the body, 0 being the head.
+    Position getBodyAt(int i) const {
+        int cell = ring[(headSlot - i) & (RING - 1)];
+        return i == 0 ? Position(headX, headY) : Position(cell % W, cell / W);
+    }
+
+    Position getHead() const { return Position(headX, headY); }
+    Direction getDirection() const { return direction; }
+    int getLength() const { return length; }
+    bool hasFood() const { return foodCell >= 0; }
+    Position getFoodPosition() const { return Position(foodCell % W, foodCell / W); }
+    bool isFoodSpecial() const { return foodSpecial; }
+    int getScore() const { return score; }
+    int getLevel() const { return level; }
+    int getTickMs() const { return tickMs; }
+    long long getTicks() const { return ticks; }
+    bool isOver() const { return over; }
+    bool hasWon() const { return won; }
+    bool wasFoodEaten() const { return foodEaten; }
+};
+
+// ---------------------------- Observations ----------------------------
+// A game's state as float planes for learning agents, written straight into
+// a buffer the caller owns (a NumPy array, say), so a step allocates
+// nothing. Cell (x, y) of plane p is
+// out[p * planeStride + y * rowStride + x * cellStride], and batches put
+// environment e at e * envStride. Strides are in floats, so padded and
+// channels-last layouts work too; floats no cell maps to are left alone.
+enum ObservationPlane { PLANE_HEAD, PLANE_BODY, PLANE_FOOD, PLANE_SPECIAL, PLANE_COUNT };
+
+struct ObservationLayout {
+    int width, height;
+    ptrdiff_t cellStride;
+    ptrdiff_t rowStride;
+    ptrdiff_t planeStride;
+    ptrdiff_t envStride;
+
+    // Planes, then rows, then cells, with nothing in between.
+    ObservationLayout(int w = 30, int h = 20)
+        : width(w), height(h), cellStride(1), rowStride(w), planeStride(static_cast<ptrdiff_t>(w) * h),
+          envStride(PLANE_COUNT * static_cast<ptrdiff_t>(w) * h) {}
+
+    float& at(float* out, int plane, int x, int y) const {
+        return out[plane * planeStride + y * rowStride + x * cellStride];
+    }
+
+    void clear(float* out) const {
+        for (int p = 0; p < PLANE_COUNT; p++) {
+            for (int y = 0; y < height; y++) {
+                float* row = &at(out, p, 0, y);
+                if (cellStride == 1) {
+                    std::fill_n(row, width, 0.0f);
+                } else {
+                    for (int x = 0; x < width; x++) row[x * cellStride] = 0.0f;
+                }
+            }
+        }
+    }
+
+    // The body plane holds each segment's age, 1 at the head down to
+    // 1/length at the tail, so the direction of travel is in one frame.
+    void segment(float* out, int index, int length, int x, int y) const {
+        at(out, PLANE_BODY, x, y) = static_cast<float>(length - index) / length;
+        if (index == 0) at(out, PLANE_HEAD, x, y) = 1.0f;
+    }
+};
+
+// Clears the planes and draws one game into them.
+inline void writeObservation(const SimulationState& state, float* out, const ObservationLayout& layout) {
+    layout.clear(out);
+    const BodyRing& body = state.getSnake().getBody();
+    int length = body.size();
+    for (int i = 0; i < length; i++) layout.segment(out, i, length, body[i].x, body[i].y);
+    const Food& food = state.getFood();
+    if (food.isAvailable()) {
+        Position p = food.getPosition();
+        layout.at(out, food.getValue() == 50 ? PLANE_SPECIAL : PLANE_FOOD, p.x, p.y) = 1.0f;
+    }
+}
+
+// ---------------------------- Snake Batch ----------------------------
+// N independent games stored as structure-of-arrays. stepAll() runs in two
+// passes: a branch-free pass over plain int arrays (turn, next head, wall
+// and food tests) that the compiler can vectorize across environments,
+// then a short scalar pass that updates the grids of the environments that
+// actually moved. Finished environments stay finished until resetEnv().
+class SnakeBatch {
+private:
+    SimulationConfig config;
+    int count;
+    int cells;
+    int wordsPerRow;
+    int wordsPerGrid;
+    int rowStride;   // rowCountSize(height)
+
+    // Per-environment scalars.
+    std::vector<int32_t> headX, headY;
+    std::vector<int32_t> direction;
+    std::vector<int32_t> length;
+    std::vector<int32_t> score;
+    std::vector<int32_t> ticks;
+    std::vector<int32_t> mealTick;   // ticks when food was last eaten
+    std::vector<int32_t> foodX, foodY, foodValue;
+    std::vector<int32_t> growing;
+    std::vector<int32_t> done;
+    std::vector<int32_t> outcome;
+    std::vector<int32_t> bodyHead;
+    std::vector<int32_t> freeCount;
+    std::vector<Pcg32> rng;
+
+    // Scratch written by the vector pass.
+    std::vector<int32_t> nextX, nextY;
+    std::vector<int32_t> moving, hitWall, ateFood;
+
+    // Per-environment board state, one fixed-size block per environment.
+    // Food lives in the scalars above, so one body plane is enough here.
+    std::vector<uint64_t> occupancy;     // wordsPerGrid words each
+    std::vector<int32_t> body;           // ring of cell indices, cells + 1 each
+    std::vector<int32_t> rowUsed;        // body cells per row and their summary, rowStride each
+
+    uint64_t* grid(int env) { return &occupancy[static_cast<size_t>(env) * wordsPerGrid]; }
+    const uint64_t* grid(int env) const { return &occupancy[static_cast<size_t>(env) * wordsPerGrid]; }
+    int32_t* ring(int env) { return &body[static_cast<size_t>(env) * (cells + 1)]; }
+    const int32_t* ring(int env) const { return &body[static_cast<size_t>(env) * (cells + 1)]; }
+    int32_t* rowCounts(int env) { return &rowUsed[static_cast<size_t>(env) * rowStride]; }
+
+    bool isOccupied(int env, int x, int y) const {
+        uint64_t word = grid(env)[y * wordsPerRow + (x >> 6)];
+        return (word >> (x & 63)) & 1;
+    }
+
+    void occupy(int env, int x, int y) {
+        grid(env)[y * wordsPerRow + (x >> 6)] |= uint64_t(1) << (x & 63);
+        addRowUsed(rowCounts(env), config.height, y, 1);
+        freeCount[env]--;
+    }
+
+    void release(int env, int x, int y) {
+        grid(env)[y * wordsPerRow + (x >> 6)] &= ~(uint64_t(1) << (x & 63));
+        addRowUsed(rowCounts(env), config.height, y, -1);
+        freeCount[env]++;
+    }
+
+    bool spawnFood(int env) {
+        if (freeCount[env] == 0) return false;
+        Pcg32& r = rng[env];
+        const uint64_t* words = grid(env);
+        const int stride = wordsPerRow;
+        Position cell = selectFreeCell(config.width, config.height, wordsPerRow, rowCounts(env),
+                                       static_cast<int>(r.nextBelow(static_cast<uint32_t>(freeCount[env]))),
+                                       [words, stride](int y, int i) { return words[y * stride + i]; });
+        foodX[env] = cell.x;
+        foodY[env] = cell.y;
+        foodValue[env] = static_cast<int>(r.nextBelow(100)) < config.specialFoodPercent ? 50 : 10;
+        return true;
+    }
+
+    // Restrict-qualified parameters tell the compiler the arrays never
+    // alias, which is what lets it vectorize this loop.
+    static void planMoves(int begin, int end, int width, int height,
+                          const int32_t* __restrict act, int32_t* __restrict dirs,
+                          const int32_t* __restrict hx, const int32_t* __restrict hy,
+                          const int32_t* __restrict fx, const int32_t* __restrict fy,
+                          const int32_t* __restrict finished,
+                          int32_t* __restrict nxOut, int32_t* __restrict nyOut,
+                          int32_t* __restrict movingOut, int32_t* __restrict wallOut,
+                          int32_t* __restrict ateOut) {
+        for (int i = begin; i < end; i++) {
+            int32_t action = act[i];
+            int32_t current = dirs[i];
+            // Keep heading on STOP or on a reversal (UP^1 == DOWN, LEFT^1 ==
+            // RIGHT). STOP^1 is no valid action, so a stopped snake takes any.
+            int32_t keep = (action == STOP) | (action == (current ^ 1));
+            int32_t dir = keep ? current : action;
+            dirs[i] = dir;
+
+            int32_t nx = hx[i] + (dir == RIGHT) - (dir == LEFT);
+            int32_t ny = hy[i] + (dir == DOWN) - (dir == UP);
+            nxOut[i] = nx;
+            nyOut[i] = ny;
+            movingOut[i] = (dir != STOP) & (finished[i] == 0);
+            wallOut[i] = (static_cast<uint32_t>(nx) >= static_cast<uint32_t>(width)) |
+                         (static_cast<uint32_t>(ny) >= static_cast<uint32_t>(height));
+            ateOut[i] = (nx == fx[i]) & (ny == fy[i]);
+        }
+    }
+
+public:
+    // Actions are read as 32-bit ints in the vector pass.
+    static_assert(sizeof(Direction) == sizeof(int32_t), "Direction must be int-sized");
+
+    // Environment i draws from stream i of the seed.
+    SnakeBatch(int environments, const SimulationConfig& cfg = SimulationConfig(), uint64_t seed = 0)
+        : config(cfg), count(environments), cells(cfg.width * cfg.height),
+          wordsPerRow((cfg.width + 63) / 64), wordsPerGrid(wordsPerRow * cfg.height),
+          rowStride(static_cast<int>(rowCountSize(cfg.height))),
+          headX(environments), headY(environments), direction(environments),
+          length(environments), score(environments), ticks(environments),
+          mealTick(environments), foodX(environments), foodY(environments), foodValue(environments),
+          growing(environments), done(environments), outcome(environments),
+          bodyHead(environments), freeCount(environments), rng(environments),
+          nextX(environments), nextY(environments),
+          moving(environments), hitWall(environments), ateFood(environments),
+          occupancy(static_cast<size_t>(environments) * wordsPerGrid),
+          body(static_cast<size_t>(environments) * (cells + 1)),
+          rowUsed(static_cast<size_t>(environments) * rowStride) {
+        for (int i = 0; i < count; i++) rng[i].seed(seed, static_cast<uint64_t>(i));
+        resetAll();
+    }
+
+    int size() const { return count; }
+    const SimulationConfig& getConfig() const { return config; }
+
+    void resetEnv(int env) {
+        std::fill(grid(env), grid(env) + wordsPerGrid, 0);
+        std::fill(rowCounts(env), rowCounts(env) + rowStride, 0);
+        freeCount[env] = cells;
+
+        // Same starting snake as Snake: three cells heading nowhere yet.
+        Position start = Snake::startPosition(config.width, config.height);
+        int32_t* r = ring(env);
+        for (int i = 0; i < 3; i++) {
+            occupy(env, start.x - i, start.y);
+            r[i] = start.y * config.width + (start.x - i);
+        }
+        bodyHead[env] = 0;
+        length[env] = 3;
+        headX[env] = start.x;
+        headY[env] = start.y;
+        direction[env] = STOP;
+        score[env] = 0;
+        ticks[env] = 0;
+        mealTick[env] = 0;
+        growing[env] = 0;
+        done[env] = 0;
+        outcome[env] = STEP_IDLE;
+        spawnFood(env);
+    }
+
+    void resetAll() {
+        for (int i = 0; i < count; i++) resetEnv(i);
+    }
+
+    void stepAll(const Direction* actions) { stepRange(0, count, actions); }
+
+    // Steps environments [begin, end); actions is indexed by environment.
+    void stepRange(int begin, int end, const Direction* actions) {
+        const int width = config.width;
+        const int height = config.height;
+
+        // Pass 1: branch-free over the batch dimension.
+        planMoves(begin, end, width, height, reinterpret_cast<const int32_t*>(actions),
+                  direction.data(), headX.data(), headY.data(), foodX.data(), foodY.data(),
+                  done.data(), nextX.data(), nextY.data(), moving.data(), hitWall.data(),
+                  ateFood.data());
+
+        // Pass 2: grid updates for the environments that moved.
+        for (int i = begin; i < end; i++) {
+            if (!moving[i]) {
+                outcome[i] = done[i] ? outcome[i] : STEP_IDLE;
+                continue;
+            }
+            ticks[i]++;
+            if (hitWall[i]) {
+                done[i] = 1;
+                outcome[i] = STEP_DIED;
+                continue;
+            }
+
+            int32_t* r = ring(i);
+            if (!growing[i]) {
+                int tailSlot = bodyHead[i] + length[i] - 1;
+                if (tailSlot > cells) tailSlot -= cells + 1;
+                int tail = r[tailSlot];
+                release(i, tail % width, tail / width);
+                length[i]--;
+            }
+            growing[i] = 0;
+
+            int nx = nextX[i], ny = nextY[i];
+            bool collided = isOccupied(i, nx, ny);
+            bodyHead[i] = bodyHead[i] == 0 ? cells : bodyHead[i] - 1;
+            r[bodyHead[i]] = ny * width + nx;
+            length[i]++;
+            if (collided) {
+                // The head goes onto the body as in Snake::move, so the
+                // final length and position match SimulationState's.
+                done[i] = 1;
+                outcome[i] = STEP_DIED;
+                continue;
+            }
+            occupy(i, nx, ny);
+            headX[i] = nx;
+            headY[i] = ny;
+
+            if (ateFood[i]) {
+                score[i] += foodValue[i];
+                mealTick[i] = ticks[i];
+                growing[i] = 1;
+                if (!spawnFood(i)) {
+                    done[i] = 1;
+                    outcome[i] = STEP_WON;
+                    continue;
+                }
+                outcome[i] = STEP_ATE;
+            } else {
+                outcome[i] = STEP_MOVED;
+            }
+        }
+    }
+
+    StepOutcome getOutcome(int env) const { return static_cast<StepOutcome>(outcome[env]); }
+    bool isDone(int env) const { return done[env] != 0; }
+    int getScore(int env) const { return score[env]; }
+    int getLength(int env) const { return length[env]; }
+    int getTicks(int env) const { return ticks[env]; }
+    int getTicksSinceMeal(int env) const { return ticks[env] - mealTick[env]; }
+    Direction getDirection(int env) const { return static_cast<Direction>(direction[env]); }
+    Position getHead(int env) const { return Position(headX[env], headY[env]); }
+    Position getFood(int env) const { return Position(foodX[env], foodY[env]); }
+    Position getTail(int env) const {
+        int tailSlot = bodyHead[env] + length[env] - 1;
+        if (tailSlot > cells) tailSlot -= cells + 1;
+        int tail = ring(env)[tailSlot];
+        return Position(tail % config.width, tail / config.width);
+    }
+    // True right after eating: the next move keeps the tail.
+    bool isGrowing(int env) const { return growing[env] != 0; }
+    int getWordsPerRow() const { return wordsPerRow; }
+    // Word i of row y of the body bitmap, as OccupancyGrid::bodyWord.
+    uint64_t bodyWord(int env, int y, int i) const { return grid(env)[y * wordsPerRow + i]; }
+
+    // Environments [begin, end) into out, environment e at e * envStride,
+    // as writeObservation. A finished game shows its final position.
+    void writeObservations(int begin, int end, float* out, const ObservationLayout& layout) const {
+        for (int env = begin; env < end; env++) {
+            float* planes = out + env * layout.envStride;
+            layout.clear(planes);
+            const int32_t* r = ring(env);
+            int slot = bodyHead[env];
+            for (int i = 0; i < length[env]; i++) {
+                layout.segment(planes, i, length[env], r[slot] % config.width, r[slot] / config.width);
+                slot = slot == cells ? 0 : slot + 1;
+            }
+            if (!done[env] || outcome[env] != STEP_WON) {
+                layout.at(planes, foodValue[env] == 50 ? PLANE_SPECIAL : PLANE_FOOD, foodX[env], foodY[env]) = 1.0f;
+            }
+        }
+    }
+    bool isCellOccupied(int env, const Position& pos) const {
+        return pos.x >= 0 && pos.x < config.width && pos.y >= 0 && pos.y < config.height &&
+               isOccupied(env, pos.x, pos.y);
+    }
+    bool isCellFree(int env, const Position& pos) const {
+        return pos.x >= 0 && pos.x < config.width && pos.y >= 0 && pos.y < config.height &&
+               !isOccupied(env, pos.x, pos.y);
+    }
+};
+
+// ---------------------------- Policies ----------------------------
+// Baseline agent for headless runs: keep going or turn at random, but never
+// into a wall or the body when a safe move exists.
+inline Position stepFrom(const Position& pos, Direction dir) {
+    switch (dir) {
+        case UP: return Position(pos.x, pos.y - 1);
+        case DOWN: return Position(pos.x, pos.y + 1);
+        case LEFT: return Position(pos.x - 1, pos.y);
+        case RIGHT: return Position(pos.x + 1, pos.y);
+        default: return pos;
+    }
+}
+
+template <typename IsFree>
+Direction pickSafeRandomTurn(const Position& head, Direction current, IsFree isFree, Pcg32& rng) {
+    static const Direction all[4] = { UP, DOWN, LEFT, RIGHT };
+    Direction options[4];
+    int count = 0;
+    for (Direction dir : all) {
+        if (!isReverse(current, dir) && isFree(stepFrom(head, dir))) options[count++] = dir;
+    }
+    if (count == 0) return STOP;
+    // Mostly keep the heading so runs look like play rather than jitter.
+    if (current != STOP && rng.nextBelow(4) != 0) {
+        for (int i = 0; i < count; i++) {
+            if (options[i] == current) return STOP;
+        }
+    }
+    return options[rng.nextBelow(static_cast<uint32_t>(count))];
+}
+
+inline Direction safeRandomPolicy(const SimulationState& state, Pcg32& rng) {
+    const Snake& snake = state.getSnake();
+    const OccupancyGrid& grid = snake.getOccupancy();
+    return pickSafeRandomTurn(snake.getHead(), snake.getDirection(),
+                              [&grid](const Position& p) { return grid.isFree(p); }, rng);
+}
+
+// safeRandomPolicy for a FixedSimulation: the same choices from the same draws.
+template <typename Sim>
+Direction fixedSafeRandomPolicy(const Sim& sim, Pcg32& rng) {
+    return pickSafeRandomTurn(sim.getHead(), sim.getDirection(),
+                              [&sim](const Position& p) { return sim.isFree(p); }, rng);
+}
+
+inline void safeRandomBatchPolicy(const SnakeBatch& batch, int begin, int end,
+                                  Direction* actions, Pcg32& rng) {
+    for (int i = begin; i < end; i++) {
+        actions[i] = pickSafeRandomTurn(batch.getHead(i), batch.getDirection(i),
+                                        [&batch, i](const Position& p) { return batch.isCellFree(i, p); }, rng);
+    }
+}
+
+// ---------------------------- Autopilot ----------------------------
+// A Hamiltonian cycle visits every cell once and returns to the start; a
+// snake that follows one never collides, at any length. It exists when the
+// board has an even number of cells and both sides are at least 2. The
+// shape is the one the benchmarks use (right along row 0, serpentine back
+// through columns 1..W-1, up column 0), transposed when only the width is
+// even. Built once per board size and shared: see forBoard().
+class HamiltonianCycle {
+private:
+    int width, height;
+    std::vector<int32_t> order;   // index of each cell along the cycle
+    std::vector<uint8_t> next;    // Direction to the following cell
+
+    static Direction serpentine(int x, int y, int w, int h) {
+        if (x == 0) return y > 0 ? UP : RIGHT;
+        if (y == 0) return x < w - 1 ? RIGHT : DOWN;
+        if (y % 2 == 1) {
+            if (x > 1) return LEFT;
+            return y == h - 1 ? LEFT : DOWN;
+        }
+        return x < w - 1 ? RIGHT : DOWN;
+    }
+
+public:
+    static bool exists(int w, int h) { return w >= 2 && h >= 2 && (w % 2 == 0 || h % 2 == 0); }
+
+    HamiltonianCycle(int w, int h) : width(w), height(h) {
+        if (!exists(w, h)) return;
+        size_t cells = static_cast<size_t>(w) * h;
+        order.resize(cells);
+        next.resize(cells);
+        bool transposed = h % 2 != 0;
+        // Seen transposed, RIGHT is DOWN and DOWN is RIGHT.
+        static const Direction fromTransposed[4] = { LEFT, RIGHT, UP, DOWN };
+        for (int y = 0; y < h; y++) {
+            for (int x = 0; x < w; x++) {
+                Direction dir = transposed ? fromTransposed[serpentine(y, x, h, w)] : serpentine(x, y, w, h);
+                next[static_cast<size_t>(y) * w + x] = static_cast<uint8_t>(dir);
+            }
+        }
+        Position p(0, 0);
+        for (size_t i = 0; i < cells; i++) {
+            size_t c = static_cast<size_t>(p.y) * w + p.x;
+            order[c] = static_cast<int32_t>(i);
+            p = stepFrom(p, static_cast<Direction>(next[c]));
+        }
+    }
+
+    bool isValid() const { return !order.empty(); }
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    int size() const { return width * height; }
+    int indexOf(const Position& p) const { return order[static_cast<size_t>(p.y) * width + p.x]; }
+    Direction directionAt(const Position& p) const {
+        return static_cast<Direction>(next[static_cast<size_t>(p.y) * width + p.x]);
+    }
+    // Steps forward along the cycle from index a to index b.
+    int distance(int a, int b) const { return b >= a ? b - a : b - a + size(); }
+
+    // One cycle per board size for the whole process; building it is O(cells)
+    // and each autopilot only keeps the pointer.
+    static std::shared_ptr<const HamiltonianCycle> forBoard(int w, int h) {
+        static std::mutex lock;
+        static std::vector<std::shared_ptr<const HamiltonianCycle>> cache;
+        std::lock_guard<std::mutex> guard(lock);
+        for (const std::shared_ptr<const HamiltonianCycle>& c : cache) {
+            if (c->width == w && c->height == h) return c;
+        }
+        cache.push_back(std::make_shared<const HamiltonianCycle>(w, h));
+        return cache.back();
+    }
+};
+
+// Plays by the cycle and cuts corners when it is safe. The body always lies
+// on a stretch of the cycle behind the head, so a move that jumps ahead
+// along the cycle, but stays short of the tail (less a margin for growth),
+// can never trap the snake. Candidates come from a breadth-first search
+// toward the food, which is kept and walked while the food stays put, and
+// otherwise from the neighbour that jumps furthest without passing the
+// food. Past half the board there is no room to cut, so it just follows the
+// cycle and always wins.
+//
+// The search is bounded by a cell budget and runs at most once per food;
+// its buffers are sized once per board and stamped with a generation
+// instead of being cleared, so a decision costs O(1) on most ticks and
+// O(budget) on the rest, whatever the board size. Boards without a cycle
+// (odd by odd) get the search, checked by a flood fill that the tail is
+// still reachable from the next cell; that is safer, not safe. Chasing the
+// tail can circle forever, so once a board's worth of ticks pass without a
+// meal it goes for the food first and the game either grows or ends.
+class Autopilot {
+private:
+    std::shared_ptr<const HamiltonianCycle> cycle;
+    int width, height;
+    int searchBudget;
+    std::vector<uint32_t> seenAt;     // generation that reached the cell
+    std::vector<int32_t> cameFrom;
+    std::vector<int32_t> frontier;
+    uint32_t generation;
+    std::vector<int32_t> path;        // reversed: back() is the next step
+    int pathFood;                     // cell the path (or failed search) was for
+    int expectedHead;
+    FloodFill room;
+    long long lastTick;               // decide(): the state's ticks last call,
+    long long mealTick;               // when the score last changed,
+    int lastScore;                    // and that score
+
+    int cellOf(const Position& p) const { return p.y * width + p.x; }
+    Position positionOf(int cell) const { return Position(cell % width, cell / width); }
+
+    static Direction towards(const Position& from, const Position& to) {
+        if (to.x > from.x) return RIGHT;
+        if (to.x < from.x) return LEFT;
+        return to.y > from.y ? DOWN : UP;
+    }
+
+    void prepare(int w, int h) {
+        if (cycle && w == width && h == height) return;
+        width = w;
+        height = h;
+        cycle = HamiltonianCycle::forBoard(w, h);
+        size_t cells = static_cast<size_t>(w) * h;
+        seenAt.assign(cells, 0);
+        cameFrom.assign(cells, 0);
+        // A search stops a few cells past its budget, so these never grow
+        // once reserved and deciding allocates nothing.
+        size_t searched = std::min(cells, static_cast<size_t>(std::max(0, searchBudget)) + 4);
+        frontier.reserve(searched);
+        path.reserve(searched);
+        generation = 0;
+        path.clear();
+        pathFood = -1;
+        expectedHead = -1;
+    }
+
+    // Shortest free path from start to goal, if it is found within the budget.
+    template <typename IsFree>
+    bool search(int start, int goal, IsFree isFree) {
+        static const Direction all[4] = { UP, DOWN, LEFT, RIGHT };
+        path.clear();
+        if (++generation == 0) {
+            std::fill(seenAt.begin(), seenAt.end(), 0);
+            generation = 1;
+        }
+        frontier.clear();
+        frontier.push_back(start);
+        seenAt[start] = generation;
+        for (size_t i = 0; i < frontier.size() && static_cast<int>(frontier.size()) <= searchBudget; i++) {
+            Position p = positionOf(frontier[i]);
+            for (Direction dir : all) {
+                Position n = stepFrom(p, dir);
+                if (!isFree(n)) continue;
+                int c = cellOf(n);
+                if (seenAt[c] == generation) continue;
+                seenAt[c] = generation;
+                cameFrom[c] = frontier[i];
+                if (c == goal) {
+                    for (int at = goal; at != start; at = cameFrom[at]) path.push_back(at);
+                    return true;
+                }
+                frontier.push_back(c);
+            }
+        }
+        return false;
+    }
+
+public:
+    explicit Autopilot(int searchBudgetCells = 2048)
+        : width(0), height(0), searchBudget(searchBudgetCells), generation(0),
+          pathFood(-1), expectedHead(-1), lastTick(0), mealTick(0), lastScore(0) {}
+
+    // Cells one search may visit; 0 turns the search off.
+    void setSearchBudget(int cells) { searchBudget = cells; }
+
+    // bodyWord(y, i) is word i of row y of the body bitmap, stride words
+    // to a row, as OccupancyGrid::bodyWord; growing means the tail stays put
+    // on the next move, and sinceMeal counts the ticks since food was last
+    // eaten (or the game began).
+    template <typename BodyWord>
+    Direction choose(int w, int h, int stride, BodyWord bodyWord, const Position& head,
+                     const Position& tail, const Position& food, int length, bool growing,
+                     long long sinceMeal) {
+        static const Direction all[4] = { UP, DOWN, LEFT, RIGHT };
+        prepare(w, h);
+        auto isFree = [&](const Position& p) {
+            return p.x >= 0 && p.x < w && p.y >= 0 && p.y < h && !((bodyWord(p.y, p.x >> 6) >> (p.x & 63)) & 1);
+        };
+        auto enterable = [&](const Position& p) { return isFree(p) || (p == tail && !growing); };
+        int headCell = cellOf(head);
+        int foodCell = cellOf(food);
+
+        if (foodCell != pathFood || headCell != expectedHead) path.clear();
+        // Without a cycle the search is all there is, so it retries each tick.
+        bool searchAgain = !cycle->isValid() && path.empty();
+        if ((foodCell != pathFood || searchAgain) && searchBudget > 0) {
+            search(headCell, foodCell, isFree);
+            pathFood = foodCell;
+        }
+
+        if (!cycle->isValid()) {
+            // Rank the moves: tail reachable after it, then (when it is
+            // not) the most room, then the path step, then nearer the food.
+            // Stalled, the last two go first.
+            Position step = path.empty() ? Position(-1, -1) : positionOf(path.back());
+            bool stalled = sinceMeal > static_cast<long long>(w) * h;
+            Direction best = STOP;
+            int bestRank[4] = { 0, 0, 0, 0 };
+            for (Direction dir : all) {
+                Position n = stepFrom(head, dir);
+                if (!enterable(n)) continue;
+                int cells = room.fill(w, h, stride, bodyWord, n, tail, tail);
+                bool tailSafe = room.isReached(tail);
+                int rank[4] = { tailSafe ? 1 : 0, tailSafe ? 0 : cells, n == step ? 1 : 0,
+                                -(std::abs(n.x - food.x) + std::abs(n.y - food.y)) };
+                if (stalled) std::rotate(rank, rank + 2, rank + 4);
+                if (best == STOP || std::lexicographical_compare(bestRank, bestRank + 4, rank, rank + 4)) {
+                    best = dir;
+                    std::copy(rank, rank + 4, bestRank);
+                }
+            }
+            if (best != STOP && stepFrom(head, best) == step) path.pop_back();
+            expectedHead = best == STOP ? -1 : cellOf(stepFrom(head, best));
+            return best;
+        }
+
+        int at = cycle->indexOf(head);
+        int reach = cycle->distance(at, cycle->indexOf(tail)) - (growing ? 1 : 0) - 3;
+        if (2 * length > cycle->size()) reach = 0;
+        reach = std::min(reach, cycle->distance(at, cycle->indexOf(food)));
+        auto jump = [&](const Position& p) {
+            if (!enterable(p)) return -1;
+            int d = cycle->distance(at, cycle->indexOf(p));
+            return d == 1 || (d > 1 && d <= reach) ? d : -1;
+        };
+
+        if (!path.empty()) {
+            Position n = positionOf(path.back());
+            if (jump(n) > 0) {
+                path.pop_back();
+                expectedHead = cellOf(n);
+                return towards(head, n);
+            }
+            path.clear();
+        }
+
+        Direction best = STOP;
+        int bestJump = 0;
+        for (Direction dir : all) {
+            int d = jump(stepFrom(head, dir));
+            if (d > bestJump) { best = dir; bestJump = d; }
+        }
+        if (best == STOP) {
+            // Off the cycle's order (the starting snake is): take the free
+            // neighbour nearest ahead and let the body line up behind.
+            int nearest = 0;
+            for (Direction dir : all) {
+                Position n = stepFrom(head, dir);
+                if (!enterable(n)) continue;
+                int d = cycle->distance(at, cycle->indexOf(n));
+                if (best == STOP || d < nearest) { best = dir; nearest = d; }
+            }
+        }
+        expectedHead = best == STOP ? -1 : cellOf(stepFrom(head, best));
+        return best;
+    }
+
+    Direction decide(const SimulationState& state) {
+        const Snake& snake = state.getSnake();
+        const OccupancyGrid& grid = snake.getOccupancy();
+        // Ticks going backwards mean a new game.
+        if (state.getTicks() < lastTick || state.getScore() != lastScore) mealTick = state.getTicks();
+        lastTick = state.getTicks();
+        lastScore = state.getScore();
+        return choose(grid.getWidth(), grid.getHeight(), grid.getWordsPerRow(),
+                      [&grid](int y, int i) { return grid.bodyWord(y, i); }, snake.getHead(),
+                      snake.getBody().back(), state.getFood().getPosition(), snake.getLength(),
+                      state.wasFoodEaten(), state.getTicks() - mealTick);
+    }
+};
+
+// Headless forms. Each worker thread keeps one autopilot, so the cycle and
+// the buffers carry over between the episodes it plays.
+inline Direction autopilotPolicy(const SimulationState& state, Pcg32&) {
+    thread_local Autopilot pilot;
+    return pilot.decide(state);
+}
+
+// Without the search: one path cache cannot follow many games at once.
+inline void autopilotBatchPolicy(const SnakeBatch& batch, int begin, int end,
+                                 Direction* actions, Pcg32&) {
+    thread_local Autopilot pilot(0);
+    const SimulationConfig& config = batch.getConfig();
+    for (int i = begin; i < end; i++) {
+        actions[i] = pilot.choose(config.width, config.height, batch.getWordsPerRow(),
+                                  [&batch, i](int y, int w) { return batch.bodyWord(i, y, w); },
+                                  batch.getHead(i), batch.getTail(i), batch.getFood(i),
+                                  batch.getLength(i), batch.isGrowing(i), batch.getTicksSinceMeal(i));
+    }
+}
+
+// ---------------------------- Arena ----------------------------
+// Many snakes on one board. Each cell holds the id of what is on it (empty,
+// food, or the snake whose body covers it), so every collision test is a
+// single lookup however many snakes there are and however long. A tick
+// resolves all moves together:
+//   1. each live snake picks its next head, with the turn rules of Snake;
+//   2. tails that move this tick leave first, as in the single game;
+//   3. heads claim cells: two heads on one cell both die, and a head on a
+//      wall or on any body dies;
+//   4. survivors push their heads and eat; the dead leave the board.
+// Steps 1 to 4 cost O(snakes); taking a dead snake off is O(its length),
+// paid once. Bodies start small and double as they grow, so memory follows
+// the snakes' total length, not snakes times board. Snake 0 is the player
+// in the game and stays dead; dead bots come back after respawnTicks.
+static const uint16_t ARENA_EMPTY = 0;
+static const uint16_t ARENA_FOOD = 0xFFFF;
+static const uint16_t ARENA_SPECIAL = 0xFFFE;
+static const int MAX_ARENA_SNAKES = 0xFFFD;
+
+class ArenaState {
+private:
+    struct Contender {
+        BodyRing body;
+        Direction direction;
+        int score;
+        bool alive;
+        bool growing;
+        int respawnIn;
+        int finalLength;               // the length it died at
+        // This tick's move.
+        Position next;
+        bool dies;
+
+        Contender()
+            : body(16), direction(STOP), score(0), alive(false), growing(false),
+              respawnIn(0), finalLength(0), next(0, 0), dies(false) {}
+    };
+
+    SimulationConfig config;
+    std::vector<uint16_t> cells;       // ARENA_* or snake id + 1
+    std::vector<Contender> snakes;
+    std::vector<Position> foods;       // x < 0: none (the board is full)
+    std::vector<uint32_t> claimedAt;   // tick stamp of the last head to claim the cell
+    std::vector<uint16_t> claimedBy;
+    Pcg32 rng;
+    long long ticks;
+    int respawnTicks;
+    int players;                       // snakes [0, players) do not respawn
+    int bodyCells;
+    long long deaths, meals;
+
+    size_t cellOf(const Position& p) const { return static_cast<size_t>(p.y) * config.width + p.x; }
+    bool contains(const Position& p) const {
+        return p.x >= 0 && p.x < config.width && p.y >= 0 && p.y < config.height;
+    }
+
+    void occupy(int id, const Position& p) {
+        cells[cellOf(p)] = static_cast<uint16_t>(id + 1);
+        bodyCells++;
+    }
+    void release(const Position& p) {
+        cells[cellOf(p)] = ARENA_EMPTY;
+        bodyCells--;
+    }
+
+    // Rejection sampling, which takes a few draws while the board is
+    // mostly open, then a scan from a random cell when it is crowded.
+    bool randomEmptyCell(Position& out) {
+        int total = config.width * config.height;
+        for (int attempt = 0; attempt < 64; attempt++) {
+            int c = static_cast<int>(rng.nextBelow(static_cast<uint32_t>(total)));
+            if (cells[c] == ARENA_EMPTY) {
+                out = Position(c % config.width, c / config.width);
+                return true;
+            }
+        }
+        int start = static_cast<int>(rng.nextBelow(static_cast<uint32_t>(total)));
+        for (int i = 0; i < total; i++) {
+            int c = (start + i) % total;
+            if (cells[c] == ARENA_EMPTY) {
+                out = Position(c % config.width, c / config.width);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void placeFood(size_t slot) {
+        Position p(-1, -1);
+        if (randomEmptyCell(p)) {
+            bool special = static_cast<int>(rng.nextBelow(100)) < config.specialFoodPercent;
+            cells[cellOf(p)] = special ? ARENA_SPECIAL : ARENA_FOOD;
+        }
+        foods[slot] = p;
+    }
+
+    // Three cells, tail to the left, at `where` or (for bots) a random
+    // empty spot; false when none was found this tick.
+    bool spawn(int id, bool atStart) {
+        Contender& s = snakes[id];
+        for (int attempt = 0; attempt < 16; attempt++) {
+            Position head = Snake::startPosition(config.width, config.height);
+            if (!atStart || attempt > 0) {
+                if (!randomEmptyCell(head)) return false;
+            }
+            if (head.x < 2) continue;
+            bool room = true;
+            for (int i = 0; i < 3 && room; i++) room = cells[cellOf(Position(head.x - i, head.y))] == ARENA_EMPTY;
+            if (!room) continue;
+            s.body.clear();
+            for (int i = 0; i < 3; i++) {
+                s.body.pushTail(Position(head.x - i, head.y));
+                occupy(id, Position(head.x - i, head.y));
+            }
+            s.direction = STOP;
+            s.score = 0;
+            s.alive = true;
+            s.growing = false;
+            return true;
+        }
+        return false;
+    }
+
+    void remove(int id) {
+        Contender& s = snakes[id];
+        s.finalLength = s.body.size();
+        while (!s.body.empty()) release(s.body.popTail());
+        s.alive = false;
+        s.respawnIn = respawnTicks;
+    }
+
+public:
+    // One food per two snakes, at least one.
+    ArenaState(const SimulationConfig& cfg, int snakeCount, uint64_t seed = 0)
+        : config(cfg), cells(static_cast<size_t>(cfg.width) * cfg.height, ARENA_EMPTY),
+          snakes(static_cast<size_t>(std::max(1, std::min(snakeCount, MAX_ARENA_SNAKES)))),
+          foods(static_cast<size_t>(std::max(1, static_cast<int>(snakes.size()) / 2)), Position(-1, -1)),
+          claimedAt(cells.size(), 0), claimedBy(cells.size(), 0), rng(seed, 0x5A),
+          ticks(0), respawnTicks(20), players(1), bodyCells(0), deaths(0), meals(0) {
+        reset();
+    }
+
+    void reset() {
+        std::fill(cells.begin(), cells.end(), ARENA_EMPTY);
+        std::fill(claimedAt.begin(), claimedAt.end(), 0);
+        bodyCells = 0;
+        ticks = 0;
+        deaths = 0;
+        meals = 0;
+        for (size_t i = 0; i < snakes.size(); i++) {
+            snakes[i].alive = false;
+            snakes[i].score = 0;
+            snakes[i].respawnIn = 0;
+            spawn(static_cast<int>(i), i == 0);
+        }
+        for (size_t f = 0; f < foods.size(); f++) placeFood(f);
+    }
+
+    void setRespawnTicks(int t) { respawnTicks = t; }
+    // Players are never respawned; 0 makes every snake a bot (headless).
+    void setPlayers(int count) { players = count; }
+
+    // actions[i] steers snake i; STOP keeps its heading.
+    void step(const Direction* actions) {
+        ticks++;
+        uint32_t stamp = static_cast<uint32_t>(ticks);
+        if (stamp == 0) std::fill(claimedAt.begin(), claimedAt.end(), 0);
+        int count = static_cast<int>(snakes.size());
+
+        // 1 and 2: pick heads, let moving tails go.
+        for (int i = 0; i < count; i++) {
+            Contender& s = snakes[i];
+            s.dies = false;
+            if (!s.alive) continue;
+            Direction dir = actions[i];
+            if (dir != STOP && !isReverse(s.direction, dir)) s.direction = dir;
+            if (s.direction == STOP) {
+                s.next = s.body.front();
+                continue;
+            }
+            s.next = stepFrom(s.body.front(), s.direction);
+            if (!s.growing) release(s.body.popTail());
+        }
+
+        // 3: claims. A second claim on a cell kills both claimants.
+        for (int i = 0; i < count; i++) {
+            Contender& s = snakes[i];
+            if (!s.alive || s.direction == STOP) continue;
+            if (!contains(s.next)) {
+                s.dies = true;
+                continue;
+            }
+            size_t c = cellOf(s.next);
+            if (claimedAt[c] == stamp) {
+                s.dies = true;
+                snakes[claimedBy[c]].dies = true;
+                continue;
+            }
+            claimedAt[c] = stamp;
+            claimedBy[c] = static_cast<uint16_t>(i);
+            uint16_t on = cells[c];
+            if (on != ARENA_EMPTY && on != ARENA_FOOD && on != ARENA_SPECIAL) s.dies = true;
+        }
+
+        // 4: move, eat, clear the dead.
+        for (int i = 0; i < count; i++) {
+            Contender& s = snakes[i];
+            if (!s.alive || s.direction == STOP) continue;
+            if (s.dies) {
+                remove(i);
+                deaths++;
+                continue;
+            }
+            s.growing = false;
+            uint16_t on = cells[cellOf(s.next)];
+            if (s.body.full()) s.body.grow();
+            s.body.pushHead(s.next);
+            occupy(i, s.next);
+            if (on == ARENA_FOOD || on == ARENA_SPECIAL) {
+                s.score += on == ARENA_SPECIAL ? 50 : 10;
+                s.growing = true;
+                meals++;
+                for (size_t f = 0; f < foods.size(); f++) {
+                    if (foods[f] == s.next) {
+                        foods[f] = Position(-1, -1);
+                        break;
+                    }
+                }
+            }
+        }
+
+        // New bots and food only once every head has landed, so none lands
+        // on a cell a head claimed this tick as empty.
+        for (int i = players; i < count; i++) {
+            if (!snakes[i].alive && !snakes[i].dies && --snakes[i].respawnIn <= 0) spawn(i, false);
+        }
+        for (size_t f = 0; f < foods.size(); f++) {
+            if (foods[f].x < 0) placeFood(f);
+        }
+    }
+
+    const SimulationConfig& getConfig() const { return config; }
+    int size() const { return static_cast<int>(snakes.size()); }
+    long long getTicks() const { return ticks; }
+    bool isAlive(int id) const { return snakes[id].alive; }
+    int getScore(int id) const { return snakes[id].score; }
+    int getLength(int id) const { return snakes[id].alive ? snakes[id].body.size() : snakes[id].finalLength; }
+    Direction getDirection(int id) const { return snakes[id].direction; }
+    Position getHead(int id) const { return snakes[id].body.empty() ? Position(0, 0) : snakes[id].body.front(); }
+    const std::vector<Position>& getFoods() const { return foods; }
+    int getBodyCells() const { return bodyCells; }
+    long long getDeaths() const { return deaths; }
+    long long getMeals() const { return meals; }
+
+    // ARENA_EMPTY, ARENA_FOOD, ARENA_SPECIAL or the covering snake's id + 1.
+    uint16_t cellAt(const Position& p) const { return cells[cellOf(p)]; }
+    bool isFree(const Position& p) const {
+        if (!contains(p)) return false;
+        uint16_t on = cells[cellOf(p)];
+        return on == ARENA_EMPTY || on == ARENA_FOOD || on == ARENA_SPECIAL;
+    }
+
+    // The player's level and tick period, on the single game's curve.
+    bool isOver() const { return !snakes[0].alive; }
+    int getLevel() const { return snakes[0].score / config.pointsPerLevel + 1; }
+    int getTickMs() const {
+        return std::max(config.minTickMs, config.baseTickMs - getLevel() * config.tickMsPerLevel);
+    }
+};
+
+// Bots head for one food each (snake i for food i mod foods), by the safe
+// neighbour nearest to it: O(1) per bot, so hundreds of them stay cheap.
+inline void arenaBotMoves(const ArenaState& arena, int first, Direction* actions, Pcg32& rng) {
+    static const Direction all[4] = { UP, DOWN, LEFT, RIGHT };
+    const std::vector<Position>& foods = arena.getFoods();
+    for (int i = first; i < arena.size(); i++) {
+        actions[i] = STOP;
+        if (!arena.isAlive(i)) continue;
+        Position head = arena.getHead(i);
+        Position target = foods[static_cast<size_t>(i) % foods.size()];
+        Direction current = arena.getDirection(i);
+        int best = -1;
+        int start = static_cast<int>(rng.nextBelow(4));
+        for (int k = 0; k < 4; k++) {
+            Direction dir = all[(start + k) % 4];
+            Position n = stepFrom(head, dir);
+            if (isReverse(current, dir) || !arena.isFree(n)) continue;
+            int distance = target.x < 0 ? 0 : std::abs(n.x - target.x) + std::abs(n.y - target.y);
+            int rank = distance * 2 + (dir == current ? 0 : 1);
+            if (best < 0 || rank < best) {
+                best = rank;
+                actions[i] = dir;
+            }
+        }
+    }
+}
+
+// ---------------------------- Work-Stealing Pool ----------------------------
+// Persistent worker threads, each with its own task deque. A worker takes
+// from the back of its own deque and, when that runs dry, steals from the
+// front of the others'. Tasks are coarse (a shard of games), so a plain
+// mutex per deque is uncontended in practice.
+class WorkStealingPool {
+public:
+    typedef std::function<void(int worker)> Task;
+
+private:
+    struct WorkerQueue {
+        std::mutex lock;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    std::vector<std::thread> threads;
+    std::mutex stateLock;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    std::atomic<long> pending;
+    long generation;
+    bool stopping;
+
+    bool popLocal(int worker, Task& task) {
+        WorkerQueue& queue = *queues[worker];
+        std::lock_guard<std::mutex> guard(queue.lock);
+        if (queue.tasks.empty()) return false;
+        task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+        return true;
+    }
+
+    bool steal(int worker, Task& task) {
+        int n = static_cast<int>(queues.size());
+        for (int k = 1; k < n; k++) {
+            WorkerQueue& victim = *queues[(worker + k) % n];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (victim.tasks.empty()) continue;
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+        return false;
+    }
+
+    void workerLoop(int worker) {
+        long seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> guard(stateLock);
+                wake.wait(guard, [&] { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+            }
+            Task task;
+            while (popLocal(worker, task) || steal(worker, task)) {
+                task(worker);
+                if (pending.fetch_sub(1) == 1) {
+                    std::lock_guard<std::mutex> guard(stateLock);
+                    finished.notify_all();
+                }
+            }
+        }
+    }
+
+public:
+    explicit WorkStealingPool(int threadCount = 0)
+        : pending(0), generation(0), stopping(false) {
+        if (threadCount <= 0) threadCount = static_cast<int>(std::thread::hardware_concurrency());
+        if (threadCount <= 0) threadCount = 1;
+        for (int i = 0; i < threadCount; i++) queues.emplace_back(new WorkerQueue());
+        for (int i = 0; i < threadCount; i++) threads.emplace_back(&WorkStealingPool::workerLoop, this, i);
+    }
+
+    ~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> guard(stateLock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& t : threads) t.join();
+    }
+
+    int size() const { return static_cast<int>(threads.size()); }
+
+    // Deals the tasks round-robin onto the workers and blocks until all ran.
+    void run(std::vector<Task>& tasks) {
+        if (tasks.empty()) return;
+        pending = static_cast<long>(tasks.size());
+        for (size_t i = 0; i < tasks.size(); i++) {
+            WorkerQueue& queue = *queues[i % queues.size()];
+            std::lock_guard<std::mutex> guard(queue.lock);
+            queue.tasks.push_back(std::move(tasks[i]));
+        }
+        std::unique_lock<std::mutex> guard(stateLock);
+        generation++;
+        wake.notify_all();
+        finished.wait(guard, [&] { return pending.load() == 0; });
+    }
+};
+
+// ---------------------------- Stats Store ----------------------------
+// Every finished game as a fixed 40-byte record, appended to a memory-mapped
+// file behind a one-page header. The header holds the record count and a
+// top-K table kept sorted on append, so opening the store and showing the
+// best scores read one page however long the history is; records are only
+// touched when appended.
+//
+// Appends are crash-safe by ordering plus checksums: the record is written
+// first and the count published after it. On open, a torn tail record
+// (failed checksum) is dropped and whole records past the count (the count
+// never made it out) are taken back, rebuilding the top-K table in that
+// rare case. An advisory file lock serialises writers, so several batch
+// runs can append to the same store.
+enum StatsFlags { STATS_WON = 1, STATS_HEADLESS = 2, STATS_AUTOPILOT = 4, STATS_ARENA = 8, STATS_VALID = 0x80000000u };
+
+struct StatsRecord {
+    int32_t score;
+    int32_t length;
+    int32_t level;
+    uint32_t flags;
+    int64_t ticks;
+    int64_t endedAt;      // unix time
+    uint32_t durationMs;  // wall time of interactive games; 0 for headless
+    uint32_t check;
+
+    StatsRecord() : score(0), length(0), level(0), flags(0), ticks(0), endedAt(0), durationMs(0), check(0) {}
+};
+
+struct StatsTopEntry {
+    int32_t score;
+    int32_t length;
+    int32_t level;
+    uint32_t flags;
+    uint64_t index;   // record number
+};
+
+static_assert(sizeof(StatsRecord) == 40, "stats records are a fixed 40 bytes");
+
+class StatsStore {
+public:
+    static const int TOP_K = 10;
+
+private:
+    static const uint32_t VERSION = 1;
+    static const size_t HEADER_BYTES = 4096;
+    static const uint64_t INITIAL_CAPACITY = 1024;
+
+    struct Header {
+        char magic[4];
+        uint32_t version;
+        uint32_t recordSize;
+        uint32_t topCount;
+        uint64_t count;
+        uint64_t capacity;
+        StatsTopEntry top[TOP_K];
+    };
+    static_assert(sizeof(Header) <= HEADER_BYTES, "stats header must fit its page");
+
+    unsigned char* base;
+    uint64_t mappedCapacity;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#else
+    int fd;
+#endif
+
+    Header& header() const { return *reinterpret_cast<Header*>(base); }
+    StatsRecord* records() const { return reinterpret_cast<StatsRecord*>(base + HEADER_BYTES); }
+    static uint64_t bytesFor(uint64_t capacity) { return HEADER_BYTES + capacity * sizeof(StatsRecord); }
+
+    // FNV-1a over everything but the check field.
+    static uint32_t checksum(const StatsRecord& r) {
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&r);
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < offsetof(StatsRecord, check); i++) hash = (hash ^ bytes[i]) * 16777619u;
+        return hash;
+    }
+
+    static bool isValid(const StatsRecord& r) {
+        return (r.flags & STATS_VALID) != 0 && r.check == checksum(r);
+    }
+
+    void lock() const {
+#ifdef _WIN32
+        OVERLAPPED at = {};
+        LockFileEx(file, LOCKFILE_EXCLUSIVE_LOCK, 0, 1, 0, &at);
+#else
+        while (flock(fd, LOCK_EX) != 0 && errno == EINTR) {}
+#endif
+    }
+
+    void unlock() const {
+#ifdef _WIN32
+        OVERLAPPED at = {};
+        UnlockFileEx(file, 0, 1, 0, &at);
+#else
+        flock(fd, LOCK_UN);
+#endif
+    }
+
+    void unmap() {
+        if (!base) return;
+#ifdef _WIN32
+        UnmapViewOfFile(base);
+        CloseHandle(mapping);
+        mapping = NULL;
+#else
+        munmap(base, bytesFor(mappedCapacity));
+#endif
+        base = nullptr;
+    }
+
+    // Grows the file to hold `capacity` records (never shrinks) and maps
+    // all of it.
+    bool map(uint64_t capacity) {
+        unmap();
+        uint64_t bytes = bytesFor(capacity);
+#ifdef _WIN32
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size)) return false;
+        if (static_cast<uint64_t>(size.QuadPart) < bytes) {
+            LARGE_INTEGER want;
+            want.QuadPart = static_cast<LONGLONG>(bytes);
+            if (!SetFilePointerEx(file, want, NULL, FILE_BEGIN) || !SetEndOfFile(file)) return false;
+        }
+        mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, static_cast<DWORD>(bytes >> 32),
+                                     static_cast<DWORD>(bytes), NULL);
+        if (!mapping) return false;
+        base = static_cast<unsigned char*>(MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, static_cast<SIZE_T>(bytes)));
+        if (!base) {
+            CloseHandle(mapping);
+            mapping = NULL;
+            return false;
+        }
+#else
+        struct stat st;
+        if (fstat(fd, &st) != 0) return false;
+        if (static_cast<uint64_t>(st.st_size) < bytes && ftruncate(fd, static_cast<off_t>(bytes)) != 0) return false;
+        void* p = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED) return false;
+        base = static_cast<unsigned char*>(p);
+#endif
+        mappedCapacity = capacity;
+        return true;
+    }
+
+    // Another process may have grown the file since we mapped it.
+    bool followCapacity() {
+        return header().capacity <= mappedCapacity || map(header().capacity);
+    }
+
+    void insertTop(const StatsRecord& r, uint64_t index) {
+        Header& h = header();
+        int pos = static_cast<int>(h.topCount);
+        while (pos > 0 && h.top[pos - 1].score < r.score) pos--;
+        if (pos >= TOP_K) return;
+        int last = std::min<int>(static_cast<int>(h.topCount), TOP_K - 1);
+        for (int i = last; i > pos; i--) h.top[i] = h.top[i - 1];
+        StatsTopEntry entry = { r.score, r.length, r.level, r.flags, index };
+        h.top[pos] = entry;
+        if (h.topCount < static_cast<uint32_t>(TOP_K)) h.topCount++;
+    }
+
+    void recover() {
+        Header& h = header();
+        uint64_t count = h.count;
+        while (count > 0 && !isValid(records()[count - 1])) count--;
+        while (count < h.capacity && isValid(records()[count])) count++;
+        if (count == h.count) return;
+        h.count = count;
+        h.topCount = 0;
+        for (uint64_t i = 0; i < count; i++) insertTop(records()[i], i);
+    }
+
+    uint64_t fileSize() const {
+#ifdef _WIN32
+        LARGE_INTEGER size;
+        return GetFileSizeEx(file, &size) ? static_cast<uint64_t>(size.QuadPart) : 0;
+#else
+        struct stat st;
+        return fstat(fd, &st) == 0 ? static_cast<uint64_t>(st.st_size) : 0;
+#endif
+    }
+
+    bool init() {
+        lock();
+        uint64_t existing = fileSize();
+        bool fresh = existing == 0;
+        // An existing file is only read (header page first) until it is
+        // known to be a store; it is never grown or rewritten otherwise.
+        bool ok = (fresh || existing >= HEADER_BYTES) && map(fresh ? INITIAL_CAPACITY : 0);
+        if (ok) {
+            Header& h = header();
+            if (fresh) {
+                std::memset(base, 0, HEADER_BYTES);
+                std::memcpy(h.magic, "SNKS", 4);
+                h.version = VERSION;
+                h.recordSize = sizeof(StatsRecord);
+                h.capacity = INITIAL_CAPACITY;
+            }
+            ok = std::memcmp(h.magic, "SNKS", 4) == 0 && h.version == VERSION &&
+                 h.recordSize == sizeof(StatsRecord) && h.topCount <= static_cast<uint32_t>(TOP_K) && h.count <= h.capacity &&
+                 (fresh || bytesFor(h.capacity) <= existing) && followCapacity();
+            if (ok) recover();
+        }
+        unlock();
+        return ok;
+    }
+
+public:
+#ifdef _WIN32
+    StatsStore() : base(nullptr), mappedCapacity(0), file(INVALID_HANDLE_VALUE), mapping(NULL) {}
+#else
+    StatsStore() : base(nullptr), mappedCapacity(0), fd(-1) {}
+#endif
+    ~StatsStore() { close(); }
+
+    bool open(const std::string& path) {
+        close();
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                           NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (file == INVALID_HANDLE_VALUE) return false;
+#else
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0) return false;
+#endif
+        if (!init()) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        unmap();
+#ifdef _WIN32
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+        file = INVALID_HANDLE_VALUE;
+#else
+        if (fd >= 0) ::close(fd);
+        fd = -1;
+#endif
+    }
+
+    bool isOpen() const { return base != nullptr; }
+
+    bool append(const StatsRecord& record) { return append(&record, 1); }
+
+    // One lock, one count update and one top-K pass per batch.
+    bool append(const StatsRecord* batch, size_t n) {
+        if (!base || n == 0) return base != nullptr;
+        lock();
+        bool ok = followCapacity();
+        if (ok) {
+            uint64_t count = header().count;
+            uint64_t capacity = header().capacity;
+            if (count + n > capacity) {
+                while (count + n > capacity) capacity *= 2;
+                ok = map(capacity);
+                if (ok) header().capacity = capacity;
+            }
+            if (ok) {
+                for (size_t i = 0; i < n; i++) {
+                    StatsRecord r = batch[i];
+                    r.flags |= STATS_VALID;
+                    r.check = checksum(r);
+                    records()[count + i] = r;
+                }
+                // Records before the count that covers them.
+                std::atomic_thread_fence(std::memory_order_release);
+                header().count = count + n;
+                for (size_t i = 0; i < n; i++) insertTop(records()[count + i], count + i);
+            }
+        }
+        unlock();
+        return ok;
+    }
+
+    uint64_t size() const { return base ? header().count : 0; }
+    int topCount() const { return base ? static_cast<int>(header().topCount) : 0; }
+    const StatsTopEntry& top(int i) const { return header().top[i]; }
+    int bestScore() const { return topCount() > 0 ? top(0).score : 0; }
+};
+
+// ---------------------------- Allocation Counter ----------------------------
+// Build with -DSNAKECYCLE_COUNT_ALLOCATIONS to count every global operator
+// new per thread; headless runs then print how many happened inside their
+// step loops, which should be none once each worker has warmed up. Normal
+// builds keep the standard allocator and the count stays 0.
+inline long long& allocationTally() {
+    thread_local long long count = 0;
+    return count;
+}
+
+// Allocations this thread has made so far.
+inline long long threadAllocations() { return allocationTally(); }
+
+#ifdef SNAKECYCLE_COUNT_ALLOCATIONS
+static void* countedAllocation(std::size_t size) {
+    allocationTally()++;
+    if (void* p = std::malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size) { return countedAllocation(size); }
+void* operator new[](std::size_t size) { return countedAllocation(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+#endif
+
+// ---------------------------- Parallel Runner ----------------------------
+// Totals for a set of finished episodes; each worker fills its own copy and
+// they are merged once the run is over.
+struct RunTotals {
+    long long episodes;
+    long long steps;
+    long long wins;
+    long long scoreSum;
+    long long lengthSum;
+    int bestScore;
+    // Heap allocations inside step loops (see threadAllocations): during
+    // each worker's first episode or step, which sizes its scratch, and after.
+    long long warmupAllocations;
+    long long stepAllocations;
+
+    RunTotals()
+        : episodes(0), steps(0), wins(0), scoreSum(0), lengthSum(0), bestScore(0),
+          warmupAllocations(0), stepAllocations(0) {}
+
+    void record(int score, int length, bool won) {
+        episodes++;
+        wins += won ? 1 : 0;
+        scoreSum += score;
+        lengthSum += length;
+        bestScore = std::max(bestScore, score);
+    }
+
+    void merge(const RunTotals& other) {
+        episodes += other.episodes;
+        steps += other.steps;
+        wins += other.wins;
+        scoreSum += other.scoreSum;
+        lengthSum += other.lengthSum;
+        bestScore = std::max(bestScore, other.bestScore);
+        warmupAllocations += other.warmupAllocations;
+        stepAllocations += other.stepAllocations;
+    }
+
+    double meanScore() const { return episodes ? static_cast<double>(scoreSum) / episodes : 0.0; }
+};
+
+// One array per field of every episode of a runEpisodes call. The worker
+// that finishes episode e fills row e - first, so rows are never shared
+// and no lock is taken; the columns come out in episode order whatever the
+// schedule.
+struct EpisodeColumns {
+    long long first;
+    std::vector<int64_t> ticks;
+    std::vector<int32_t> score;
+    std::vector<int32_t> length;
+    std::vector<int32_t> level;
+    std::vector<uint8_t> won;
+
+    EpisodeColumns() : first(0) {}
+
+    void resize(size_t rows) {
+        ticks.resize(rows);
+        score.resize(rows);
+        length.resize(rows);
+        level.resize(rows);
+        won.resize(rows);
+    }
+
+    void put(long long episode, int s, int len, int lvl, long long t, bool w) {
+        size_t row = static_cast<size_t>(episode - first);
+        ticks[row] = t;
+        score[row] = s;
+        length[row] = len;
+        level[row] = lvl;
+        won[row] = w ? 1 : 0;
+    }
+};
+
+typedef std::function<Direction(const SimulationState&, Pcg32&)> EpisodePolicy;
+typedef std::function<void(const SnakeBatch&, int, int, Direction*, Pcg32&)> BatchPolicy;
+
+// Runs simulations on a WorkStealingPool. Randomness never depends on which
+// worker picks up a task: every episode (or batch shard) draws food and
+// policy decisions from its own PCG stream of the run seed, so a run is
+// reproducible bit for bit at any thread count. Episodes that end are reset
+// in place so a shard keeps its games busy until its budget is spent.
+class ParallelRunner {
+private:
+    // A worker's game lives from run to run and is reset in place for each
+    // episode, so its body ring and grid are allocated once per worker.
+    struct alignas(64) WorkerState {
+        RunTotals totals;
+        std::unique_ptr<SimulationState> sim;
+        bool warm;
+
+        WorkerState() : warm(false) {}
+
+        void countAllocations(long long since) {
+            long long made = threadAllocations() - since;
+            if (warm) totals.stepAllocations += made;
+            else totals.warmupAllocations += made;
+            warm = true;
+        }
+    };
+
+    WorkStealingPool pool;
+    std::vector<WorkerState> workers;
+    uint64_t seed;
+    EpisodeColumns* columns;
+
+    // Finished games go to the stats store as the run goes, in a fixed
+    // order whatever the schedule: each chunk of episodes (or shard of a
+    // batch) collects its records in its own slot, and slots are appended
+    // in order as soon as all before them are in.
+    StatsStore* statsStore;
+    std::mutex statsMutex;
+    std::vector<std::vector<StatsRecord>> slotRecords;
+    std::vector<bool> slotDone;
+    size_t nextSlot;
+    bool statsFailed;
+
+    void beginRun(size_t slots) {
+        for (WorkerState& w : workers) {
+            w.totals = RunTotals();
+            w.warm = false;
+        }
+        slotRecords.assign(statsStore ? slots : 0, std::vector<StatsRecord>());
+        slotDone.assign(slotRecords.size(), false);
+        nextSlot = 0;
+    }
+
+    // Appends slot and then every finished slot after it.
+    void finishSlot(size_t slot) {
+        if (!statsStore) return;
+        std::lock_guard<std::mutex> hold(statsMutex);
+        slotDone[slot] = true;
+        for (; nextSlot < slotDone.size() && slotDone[nextSlot]; nextSlot++) {
+            std::vector<StatsRecord>& records = slotRecords[nextSlot];
+            if (!statsStore->append(records.data(), records.size())) statsFailed = true;
+            std::vector<StatsRecord>().swap(records);
+        }
+    }
+
+    // Chunk size for `episodes` games: 16 chunks a thread, and with a stats
+    // store at most STATS_CHUNK so records never pile up in memory.
+    long long chunkSize(long long episodes) const {
+        long long chunk = std::max(1LL, episodes / (pool.size() * 16LL));
+        return statsStore ? std::min(chunk, STATS_CHUNK) : chunk;
+    }
+
+    void keep(std::vector<StatsRecord>* out, int score, int length, int level, long long ticks, bool won) {
+        if (!out) return;
+        StatsRecord r;
+        r.score = score;
+        r.length = length;
+        r.level = level;
+        r.ticks = ticks;
+        r.flags = won ? STATS_HEADLESS | STATS_WON : STATS_HEADLESS;
+        r.endedAt = static_cast<int64_t>(time(nullptr));
+        out->push_back(r);
+    }
+
+    uint64_t policySeed() const { return seed ^ 0x9E3779B97F4A7C15ULL; }
+
+    // Episodes first..last-1 on `sim`, which is reseeded and reset for each;
+    // they are stats slot `slot`.
+    template <typename Sim, typename Policy>
+    void playEpisodes(WorkerState& self, Sim& sim, size_t slot, long long first, long long last,
+                      const Policy& policy, long long maxTicks) {
+        std::vector<StatsRecord>* records = statsStore ? &slotRecords[slot] : nullptr;
+        Pcg32 rng;
+        for (long long e = first; e < last; e++) {
+            sim.seed(seed, static_cast<uint64_t>(e));
+            sim.reset();
+            rng.seed(policySeed(), static_cast<uint64_t>(e));
+            long long allocations = threadAllocations();
+            while (!sim.isOver() && sim.getTicks() < maxTicks) {
+                if (sim.step(policy(sim, rng)) == STEP_IDLE) break;
+            }
+            self.countAllocations(allocations);
+            self.totals.record(sim.getScore(), sim.getLength(), sim.hasWon());
+            self.totals.steps += sim.getTicks();
+            keep(records, sim.getScore(), sim.getLength(), sim.getLevel(), sim.getTicks(), sim.hasWon());
+            if (columns) columns->put(e, sim.getScore(), sim.getLength(), sim.getLevel(), sim.getTicks(), sim.hasWon());
+        }
+        finishSlot(slot);
+    }
+
+    RunTotals endRun() {
+        RunTotals total;
+        for (WorkerState& w : workers) total.merge(w.totals);
+        return total;
+    }
+
+public:
+    static constexpr long long STATS_CHUNK = 4096;
+
+    explicit ParallelRunner(int threads = 0, uint64_t runSeed = 0)
+        : pool(threads), workers(pool.size()), seed(runSeed), columns(nullptr),
+          statsStore(nullptr), nextSlot(0), statsFailed(false) {}
+
+    int threadCount() const { return pool.size(); }
+
+    // Also append one StatsRecord per finished game to `store` (null
+    // stops), a chunk at a time while the run goes, in episode order for
+    // runEpisodes and in shard order per round of steps for runBatch.
+    void setStatsStore(StatsStore* store) { statsStore = store; }
+    // True once an append to the store has failed.
+    bool statsWriteFailed() const { return statsFailed; }
+
+    // Also fill these columns, sized to the episodes of each run and with
+    // `first` set to its first episode; null stops.
+    void setColumns(EpisodeColumns* out) { columns = out; }
+
+    // Plays `episodes` independent games, numbered from firstEpisode and
+    // handed out in chunks. Episode e uses stream e of the seed for food and
+    // stream e of the policy seed for the agent. maxTicks caps a single
+    // episode.
+    RunTotals runEpisodes(const SimulationConfig& config, long long episodes, const EpisodePolicy& policy,
+                          long long maxTicks = 1000000, long long firstEpisode = 0) {
+        long long chunk = chunkSize(episodes);
+        beginRun(static_cast<size_t>((episodes + chunk - 1) / chunk));
+        long long end = firstEpisode + episodes;
+        std::vector<WorkStealingPool::Task> tasks;
+        for (long long first = firstEpisode; first < end; first += chunk) {
+            long long last = std::min(end, first + chunk);
+            size_t slot = tasks.size();
+            tasks.push_back([this, &config, &policy, slot, first, last, maxTicks](int worker) {
+                WorkerState& self = workers[worker];
+                if (!self.sim || !(self.sim->getConfig() == config)) self.sim.reset(new SimulationState(config));
+                playEpisodes(self, *self.sim, slot, first, last, policy, maxTicks);
+            });
+        }
+        pool.run(tasks);
+        return endRun();
+    }
+
+    // runEpisodes on a FixedSimulation type, with the same streams and so
+    // the same results as the runtime game of its size and rules. Each task
+    // keeps its game on the stack and the policy is called directly.
+    template <typename Sim, typename Policy>
+    RunTotals runFixedEpisodes(long long episodes, Policy policy, long long maxTicks = 1000000,
+                               long long firstEpisode = 0) {
+        long long chunk = chunkSize(episodes);
+        beginRun(static_cast<size_t>((episodes + chunk - 1) / chunk));
+        long long end = firstEpisode + episodes;
+        std::vector<WorkStealingPool::Task> tasks;
+        for (long long first = firstEpisode; first < end; first += chunk) {
+            long long last = std::min(end, first + chunk);
+            size_t slot = tasks.size();
+            tasks.push_back([this, &policy, slot, first, last, maxTicks](int worker) {
+                Sim sim;
+                playEpisodes(workers[worker], sim, slot, first, last, policy, maxTicks);
+            });
+        }
+        pool.run(tasks);
+        return endRun();
+    }
+
+    // Steps every game of the batch `steps` times. The batch is cut into
+    // contiguous shards of environments; games are independent, so a shard
+    // runs all its steps without waiting on the others. With a stats store
+    // the steps go in rounds of STATS_ROUND, and each round's finished games
+    // are appended, shard by shard, before the next.
+    RunTotals runBatch(SnakeBatch& batch, int steps, const BatchPolicy& policy, int shardSize = 256) {
+        int shards = (batch.size() + shardSize - 1) / shardSize;
+        beginRun(static_cast<size_t>(shards));
+        std::vector<Direction> actions(batch.size(), STOP);
+        std::vector<Pcg32> rngs;
+        for (int shard = 0; shard < shards; shard++) rngs.push_back(Pcg32(policySeed(), static_cast<uint64_t>(shard) * shardSize));
+        int round = statsStore ? std::min(steps, STATS_ROUND) : steps;
+        for (int done = 0; done < steps; done += round) {
+            int count = std::min(round, steps - done);
+            runBatchRound(batch, count, policy, shardSize, actions, rngs);
+            for (size_t shard = 0; shard < slotDone.size(); shard++) finishSlot(shard);
+            slotDone.assign(slotDone.size(), false);
+            nextSlot = 0;
+        }
+        return endRun();
+    }
+
+private:
+    static constexpr int STATS_ROUND = 1024;
+
+    void runBatchRound(SnakeBatch& batch, int steps, const BatchPolicy& policy, int shardSize,
+                       std::vector<Direction>& actions, std::vector<Pcg32>& rngs) {
+        std::vector<WorkStealingPool::Task> tasks;
+        for (int begin = 0; begin < batch.size(); begin += shardSize) {
+            int end = std::min(batch.size(), begin + shardSize);
+            size_t slot = tasks.size();
+            tasks.push_back([this, &batch, &actions, &policy, &rngs, slot, begin, end, steps](int worker) {
+                WorkerState& self = workers[worker];
+                std::vector<StatsRecord>* records = statsStore ? &slotRecords[slot] : nullptr;
+                Pcg32& rng = rngs[slot];
+                for (int s = 0; s < steps; s++) {
+                    long long allocations = threadAllocations();
+                    policy(batch, begin, end, actions.data(), rng);
+                    batch.stepRange(begin, end, actions.data());
+                    self.countAllocations(allocations);
+                    for (int i = begin; i < end; i++) {
+                        if (!batch.isDone(i)) continue;
+                        self.totals.record(batch.getScore(i), batch.getLength(i),
+                                           batch.getOutcome(i) == STEP_WON);
+                        keep(records, batch.getScore(i), batch.getLength(i),
+                             batch.getScore(i) / batch.getConfig().pointsPerLevel + 1, batch.getTicks(i),
+                             batch.getOutcome(i) == STEP_WON);
+                        batch.resetEnv(i);
+                    }
+                }
+                self.totals.steps += static_cast<long long>(end - begin) * steps;
+            });
+        }
+        pool.run(tasks);
+    }
+};
+
+// ---------------------------- Parameter Sweeps ----------------------------
+// A sweep plays the same episodes under every configuration of a grid. The
+// grid is a list of keys, each with comma-separated values, and the sweep
+// runs their Cartesian product:
+//
+//   size=30x20,60x40;special=0,10;points=100;policy=random,autopilot
+//
+// There is no speed key: the tick period is only how long a game waits
+// between ticks, and headless games do not wait. Keys left out keep the
+// values given on the command line. Every configuration plays
+// episodes 0..N-1 of the same seed, so they see the same food and agent
+// random streams and compare pairwise.
+enum SweepPolicy { SWEEP_RANDOM = 0, SWEEP_AUTOPILOT = 1 };
+
+struct SweepConfig {
+    SimulationConfig config;
+    SweepPolicy policy;
+
+    SweepConfig() : policy(SWEEP_RANDOM) {}
+};
+
+static const size_t MAX_SWEEP_CONFIGS = 65536;
+
+// `count` non-negative integers joined by `separator`, and nothing else.
+inline bool parseSweepFields(const std::string& text, char separator, int* fields, int count) {
+    const char* p = text.c_str();
+    for (int i = 0; i < count; i++) {
+        char* end;
+        errno = 0;
+        long long value = std::strtoll(p, &end, 10);
+        if (end == p || errno != 0 || value < 0 || value > 0x7FFFFFFF) return false;
+        fields[i] = static_cast<int>(value);
+        if (*end != (i + 1 < count ? separator : '\0')) return false;
+        p = end + 1;
+    }
+    return true;
+}
+
+inline bool applySweepValue(const std::string& key, const std::string& value, SweepConfig& sweep) {
+    SimulationConfig& config = sweep.config;
+    if (key == "size") {
+        int size[2];
+        if (!parseSweepFields(value, 'x', size, 2)) return false;
+        config.width = size[0];
+        config.height = size[1];
+        return config.width >= 4 && config.height >= 1 &&
+               static_cast<long long>(config.width) * config.height <= MAX_BOARD_CELLS;
+    }
+    if (key == "special") return parseSweepFields(value, '\0', &config.specialFoodPercent, 1) &&
+                                 config.specialFoodPercent <= 100;
+    if (key == "points") return parseSweepFields(value, '\0', &config.pointsPerLevel, 1) &&
+                                config.pointsPerLevel >= 1;
+    if (key == "policy") {
+        if (value != "random" && value != "autopilot") return false;
+        sweep.policy = value == "random" ? SWEEP_RANDOM : SWEEP_AUTOPILOT;
+        return true;
+    }
+    return false;
+}
+
+// Expands `spec` over `base` into `out`. On a bad key or value, returns
+// false with `error` naming it.
+inline bool parseSweepGrid(const std::string& spec, const SweepConfig& base, std::vector<SweepConfig>& out,
+                           std::string& error) {
+    out.assign(1, base);
+    size_t begin = 0;
+    while (begin <= spec.size()) {
+        size_t end = std::min(spec.find(';', begin), spec.size());
+        std::string clause = spec.substr(begin, end - begin);
+        begin = end + 1;
+        if (clause.empty()) continue;
+        size_t equals = clause.find('=');
+        if (equals == std::string::npos) {
+            error = "expected key=values, got '" + clause + "'";
+            return false;
+        }
+        std::string key = clause.substr(0, equals);
+        if (key != "size" && key != "special" && key != "points" && key != "policy") {
+            error = key == "speed" ? "speed is not a sweep key: headless games never wait for a tick"
+                                   : "unknown key '" + key + "'";
+            return false;
+        }
+        std::vector<SweepConfig> expanded;
+        size_t at = equals + 1;
+        while (at <= clause.size()) {
+            size_t comma = std::min(clause.find(',', at), clause.size());
+            std::string value = clause.substr(at, comma - at);
+            at = comma + 1;
+            for (SweepConfig sweep : out) {
+                if (!applySweepValue(key, value, sweep)) {
+                    error = "bad value '" + value + "' for " + key;
+                    return false;
+                }
+                expanded.push_back(sweep);
+            }
+            if (expanded.size() > MAX_SWEEP_CONFIGS) {
+                error = "grid has more than " + std::to_string(MAX_SWEEP_CONFIGS) + " configurations";
+                return false;
+            }
+        }
+        out.swap(expanded);
+    }
+    return true;
+}
+
+// Per-episode results as columns, in host byte order like the stats store:
+//
+//   header  "SNKW" u32 version, u32 configs, u32 reserved
+//   configs per configuration, i32 width height specialFoodPercent
+//           pointsPerLevel baseTickMs tickMsPerLevel minTickMs policy
+//   blocks  "SNKB" u32 config, u64 first episode, u32 rows, u32 reserved,
+//           then each column whole: i64 ticks, i32 score, i32 length,
+//           i32 level, u8 won, zero padding to 8 bytes
+//
+// A block holds consecutive episodes of one configuration, so a reader can
+// map each column straight into an array.
+static const char SWEEP_MAGIC[4] = { 'S', 'N', 'K', 'W' };
+static const char SWEEP_BLOCK_MAGIC[4] = { 'S', 'N', 'K', 'B' };
+static const uint32_t SWEEP_VERSION = 1;
+
+class SweepWriter {
+private:
+    FILE* file;
+    bool ok;
+
+    void put(const void* data, size_t bytes) {
+        if (ok && bytes > 0) ok = std::fwrite(data, 1, bytes, file) == bytes;
+    }
+
+    template <typename T>
+    void putColumn(const std::vector<T>& column) {
+        put(column.data(), column.size() * sizeof(T));
+    }
+
+public:
+    SweepWriter() : file(nullptr), ok(false) {}
+    ~SweepWriter() { close(); }
+
+    bool open(const std::string& path, const std::vector<SweepConfig>& configs) {
+        file = std::fopen(path.c_str(), "wb");
+        ok = file != nullptr;
+        if (!ok) return false;
+        uint32_t header[3] = { SWEEP_VERSION, static_cast<uint32_t>(configs.size()), 0 };
+        put(SWEEP_MAGIC, sizeof(SWEEP_MAGIC));
+        put(header, sizeof(header));
+        for (const SweepConfig& sweep : configs) {
+            const SimulationConfig& c = sweep.config;
+            const int32_t row[8] = { c.width, c.height, c.specialFoodPercent, c.pointsPerLevel,
+                                     c.baseTickMs, c.tickMsPerLevel, c.minTickMs, sweep.policy };
+            put(row, sizeof(row));
+        }
+        return ok;
+    }
+
+    bool block(uint32_t config, const EpisodeColumns& columns) {
+        size_t count = columns.ticks.size();
+        uint64_t first = static_cast<uint64_t>(columns.first);
+        uint32_t rows[2] = { static_cast<uint32_t>(count), 0 };
+        put(SWEEP_BLOCK_MAGIC, sizeof(SWEEP_BLOCK_MAGIC));
+        put(&config, sizeof(config));
+        put(&first, sizeof(first));
+        put(rows, sizeof(rows));
+        putColumn(columns.ticks);
+        putColumn(columns.score);
+        putColumn(columns.length);
+        putColumn(columns.level);
+        putColumn(columns.won);
+        static const char padding[8] = {};
+        put(padding, (8 - count * 21 % 8) % 8);   // 21 bytes a row
+        return ok;
+    }
+
+    // False if any write failed.
+    bool close() {
+        if (!file) return ok;
+        ok = std::fclose(file) == 0 && ok;
+        file = nullptr;
+        return ok;
+    }
+};
+
+// ---------------------------- Replays ----------------------------
+// A replay is the seed and rules of a session plus one event per turn the
+// player made; feeding the same turns to SimulationState reproduces every
+// game exactly, with no frames stored. All integers are LEB128 varints:
+//
+//   "SNKR" version
+//   width height specialFoodPercent pointsPerLevel baseTickMs tickMsPerLevel minTickMs seed
+//   events: (ticks since the previous event of the episode, code byte)...
+//
+// Codes 0-3 are the Direction turned to on that tick. REPLAY_RESET starts
+// the next episode (a restart) and REPLAY_END marks the tick the session
+// was quit on.
+enum ReplayCode { REPLAY_RESET = 4, REPLAY_END = 5 };
+
+struct ReplayEvent {
+    long long tick;   // SimulationState::getTicks() when it happened
+    int code;
+};
+
+static const char REPLAY_MAGIC[4] = { 'S', 'N', 'K', 'R' };
+static const int REPLAY_VERSION = 1;
+
+// Append-only and buffered: events collect in memory and reach the file in
+// 4 KB writes, at each episode boundary and on finish().
+class ReplayWriter {
+private:
+    FILE* file;
+    std::string buffer;
+    long long lastTick;
+
+    void putVarint(uint64_t value) {
+        while (value >= 0x80) {
+            buffer += static_cast<char>((value & 0x7F) | 0x80);
+            value >>= 7;
+        }
+        buffer += static_cast<char>(value);
+    }
+
+    void event(long long tick, int code) {
+        putVarint(static_cast<uint64_t>(std::max(0LL, tick - lastTick)));
+        buffer += static_cast<char>(code);
+        lastTick = tick;
+        if (buffer.size() >= 4096) flush();
+    }
+
+public:
+    ReplayWriter() : file(nullptr), lastTick(0) {}
+    ~ReplayWriter() { finish(lastTick); }
+
+    bool open(const std::string& path, const SimulationConfig& config, uint64_t seed) {
+        file = std::fopen(path.c_str(), "wb");
+        if (!file) return false;
+        buffer.assign(REPLAY_MAGIC, sizeof(REPLAY_MAGIC));
+        putVarint(REPLAY_VERSION);
+        const int fields[7] = { config.width, config.height, config.specialFoodPercent, config.pointsPerLevel,
+                                config.baseTickMs, config.tickMsPerLevel, config.minTickMs };
+        for (int field : fields) putVarint(static_cast<uint64_t>(field));
+        putVarint(seed);
+        lastTick = 0;
+        return flush();
+    }
+
+    bool isOpen() const { return file != nullptr; }
+
+    void turn(long long tick, Direction dir) {
+        if (file) event(tick, dir);
+    }
+
+    void reset(long long tick) {
+        if (!file) return;
+        event(tick, REPLAY_RESET);
+        lastTick = 0;
+        flush();
+    }
+
+    void finish(long long tick) {
+        if (!file) return;
+        event(tick, REPLAY_END);
+        flush();
+        std::fclose(file);
+        file = nullptr;
+    }
+
+    bool flush() {
+        if (!file) return false;
+        bool ok = std::fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size() && std::fflush(file) == 0;
+        buffer.clear();
+        return ok;
+    }
+};
+
+class ReplayReader {
+private:
+    std::vector<unsigned char> data;
+    size_t pos;
+    long long episodeTick;
+    SimulationConfig config;
+    uint64_t seed;
+    std::string error;
+
+    bool getVarint(uint64_t& value) {
+        value = 0;
+        for (int shift = 0; shift < 64 && pos < data.size(); shift += 7) {
+            unsigned char byte = data[pos++];
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80)) return true;
+        }
+        return false;
+    }
+
+    bool fail(const char* message) {
+        error = message;
+        return false;
+    }
+
+public:
+    ReplayReader() : pos(0), episodeTick(0), seed(0) {}
+
+    bool open(const std::string& path) {
+        FILE* file = std::fopen(path.c_str(), "rb");
+        if (!file) return fail("cannot open replay");
+        data.clear();
+        unsigned char chunk[65536];
+        size_t n;
+        while ((n = std::fread(chunk, 1, sizeof(chunk), file)) > 0) data.insert(data.end(), chunk, chunk + n);
+        std::fclose(file);
+
+        pos = sizeof(REPLAY_MAGIC);
+        if (data.size() < pos || std::memcmp(data.data(), REPLAY_MAGIC, pos) != 0) return fail("not a replay file");
+        uint64_t version;
+        if (!getVarint(version) || version != REPLAY_VERSION) return fail("unsupported replay version");
+        int* fields[7] = { &config.width, &config.height, &config.specialFoodPercent, &config.pointsPerLevel,
+                           &config.baseTickMs, &config.tickMsPerLevel, &config.minTickMs };
+        for (int* field : fields) {
+            uint64_t value;
+            if (!getVarint(value) || value > 0x7FFFFFFF) return fail("corrupt replay header");
+            *field = static_cast<int>(value);
+        }
+        if (!getVarint(seed) || !config.isValid()) return fail("corrupt replay header");
+        episodeTick = 0;
+        return true;
+    }
+
+    const SimulationConfig& getConfig() const { return config; }
+    uint64_t getSeed() const { return seed; }
+    const std::string& getError() const { return error; }
+
+    // False at the end of the data; a file cut short ends at its last
+    // complete event.
+    bool next(ReplayEvent& event) {
+        uint64_t delta;
+        if (pos >= data.size() || !getVarint(delta) || pos >= data.size()) return false;
+        event.code = data[pos++];
+        event.tick = episodeTick + static_cast<long long>(delta);
+        episodeTick = event.code == REPLAY_RESET ? 0 : event.tick;
+        return true;
+    }
+};
+
+// Turns a replay back into step() actions, one episode at a time. Works
+// the same for the headless fast-forward and the rendered playback.
+class ReplayPlayer {
+private:
+    ReplayReader reader;
+    ReplayEvent pending;
+    bool hasPending;
+
+    void advance() { hasPending = reader.next(pending); }
+
+public:
+    ReplayPlayer() : hasPending(false) {}
+
+    bool open(const std::string& path) {
+        if (!reader.open(path)) return false;
+        advance();
+        return true;
+    }
+
+    const ReplayReader& getReader() const { return reader; }
+
+    // The action for the next step of sim: the recorded turn when one was
+    // made on this tick, otherwise STOP (keep going).
+    Direction actionFor(const SimulationState& sim) {
+        while (hasPending && pending.code < REPLAY_RESET && pending.tick < sim.getTicks()) advance();
+        // A stopped snake does not count ticks, so its next turn is due now.
+        bool due = pending.tick == sim.getTicks() || sim.getSnake().getDirection() == STOP;
+        if (hasPending && pending.code < REPLAY_RESET && due) {
+            Direction dir = static_cast<Direction>(pending.code);
+            advance();
+            return dir;
+        }
+        return STOP;
+    }
+
+    // True when the recorded episode stops here: the game is over, the
+    // session was quit on this tick, or the recording ran out before the
+    // snake ever moved.
+    bool episodeOver(const SimulationState& sim) const {
+        if (sim.isOver()) return true;
+        if (!hasPending) return sim.getSnake().getDirection() == STOP;
+        return pending.code >= REPLAY_RESET && pending.tick <= sim.getTicks();
+    }
+
+    // Skips to the next episode boundary. True when another episode
+    // follows; reset the simulation before stepping it.
+    bool nextEpisode() {
+        while (hasPending && pending.code < REPLAY_RESET) advance();
+        if (!hasPending || pending.code != REPLAY_RESET) return false;
+        advance();
+        return true;
+    }
+};
+
+// ---------------------------- Spectator Stream ----------------------------
+// What a SpectatorServer sends its viewers, in the varints of the replay
+// format:
+//
+//   "SNKS" version width height specialFoodPercent pointsPerLevel baseTickMs tickMsPerLevel minTickMs
+//   messages: (byte length, type, fields)...
+//
+// A SPECTATE_KEYFRAME is the whole position: end flags, score, the food
+// (cell + 1, 0 for none, then a special byte), the heading, the length,
+// and the body as its tail cell plus one 2-bit Direction per segment
+// toward the head, four to a byte. A SPECTATE_TICK is one step: a
+// TickFlags byte, then the new head's Direction, the new food and the
+// score, each only when its flag is set. Viewers apply ticks to the last
+// keyframe with pushHead and popTail, so a tick is a few bytes however
+// long the snake is.
+enum SpectateType { SPECTATE_KEYFRAME = 1, SPECTATE_TICK = 2 };
+enum TickFlags { TICK_HEAD = 1, TICK_POP = 2, TICK_FOOD = 4, TICK_SCORE = 8, TICK_OVER = 16, TICK_WON = 32 };
+
+static const char SPECTATE_MAGIC[4] = { 'S', 'N', 'K', 'S' };
+static const int SPECTATE_VERSION = 1;
+
+inline void appendVarint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out += static_cast<char>((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+// False when the bytes run out first (or the value is too long).
+inline bool takeVarint(const unsigned char*& p, const unsigned char* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        unsigned char byte = *p++;
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+class SpectatorEncoder {
+private:
+    std::string body;
+
+    void appendFood(const SimulationState& sim) {
+        const Food& food = sim.getFood();
+        if (!food.isAvailable()) {
+            appendVarint(body, 0);
+            return;
+        }
+        Position p = food.getPosition();
+        appendVarint(body, static_cast<uint64_t>(p.y) * sim.getConfig().width + p.x + 1);
+        body += static_cast<char>(food.getValue() == 50 ? 1 : 0);
+    }
+
+    void finish(std::string& out) {
+        appendVarint(out, body.size());
+        out += body;
+    }
+
+public:
+    static void header(const SimulationConfig& config, std::string& out) {
+        out.append(SPECTATE_MAGIC, sizeof(SPECTATE_MAGIC));
+        appendVarint(out, SPECTATE_VERSION);
+        const int fields[7] = { config.width, config.height, config.specialFoodPercent, config.pointsPerLevel,
+                                config.baseTickMs, config.tickMsPerLevel, config.minTickMs };
+        for (int field : fields) appendVarint(out, static_cast<uint64_t>(field));
+    }
+
+    void keyframe(const SimulationState& sim, std::string& out) {
+        const BodyRing& ring = sim.getSnake().getBody();
+        int length = ring.size();
+
+        body.assign(1, static_cast<char>(SPECTATE_KEYFRAME));
+        body += static_cast<char>((sim.isOver() ? TICK_OVER : 0) | (sim.hasWon() ? TICK_WON : 0));
+        appendVarint(body, static_cast<uint64_t>(sim.getScore()));
+        appendFood(sim);
+        appendVarint(body, static_cast<uint64_t>(sim.getSnake().getDirection()));
+        appendVarint(body, static_cast<uint64_t>(length));
+        if (length > 0) {
+            Position tail = ring[ring.size() - 1];
+            appendVarint(body, static_cast<uint64_t>(tail.y) * sim.getConfig().width + tail.x);
+            unsigned char packed = 0;
+            int bits = 0;
+            for (int i = ring.size() - 1, k = 1; k < length; i--, k++) {
+                Position from = ring[i], to = ring[i - 1];
+                Direction dir = to.y < from.y ? UP : to.y > from.y ? DOWN : to.x < from.x ? LEFT : RIGHT;
+                packed |= static_cast<unsigned char>(dir << bits);
+                bits += 2;
+                if (bits == 8) {
+                    body += static_cast<char>(packed);
+                    packed = 0;
+                    bits = 0;
+                }
+            }
+            if (bits > 0) body += static_cast<char>(packed);
+        }
+        finish(out);
+    }
+
+    // What the step that returned `outcome` changed. A losing move sends
+    // only the end: viewers keep the last legal position.
+    void tick(const SimulationState& sim, StepOutcome outcome, std::string& out) {
+        const MoveDelta& move = sim.getSnake().getLastMove();
+        int flags = 0;
+        if (outcome == STEP_DIED) {
+            flags = TICK_OVER;
+        } else if (move.moved) {
+            flags = TICK_HEAD | (move.tailVacated ? TICK_POP : 0);
+            if (sim.wasFoodEaten()) flags |= TICK_FOOD | TICK_SCORE;
+            if (outcome == STEP_WON) flags |= TICK_OVER | TICK_WON;
+        }
+        body.assign(1, static_cast<char>(SPECTATE_TICK));
+        body += static_cast<char>(flags);
+        if (flags & TICK_HEAD) body += static_cast<char>(sim.getSnake().getDirection());
+        if (flags & TICK_FOOD) appendFood(sim);
+        if (flags & TICK_SCORE) appendVarint(body, static_cast<uint64_t>(sim.getScore()));
+        finish(out);
+    }
+};
+
+// The viewer's copy of the game, rebuilt from the stream. Bytes can arrive
+// in any split; feed() keeps an incomplete message until the rest comes.
+class SpectatorMirror {
+private:
+    SimulationConfig config;
+    Snake snake;
+    Food food;
+    int score;
+    bool over;
+    bool won;
+    bool hasHeader;
+    bool synced;
+    bool repaint;
+    std::vector<unsigned char> pending;
+    std::string error;
+
+    bool fail(const char* message) {
+        error = message;
+        return false;
+    }
+
+    bool cellPosition(uint64_t cell, Position& out) const {
+        if (cell >= static_cast<uint64_t>(config.width) * config.height) return false;
+        out = Position(static_cast<int>(cell % config.width), static_cast<int>(cell / config.width));
+        return true;
+    }
+
+    bool readFood(const unsigned char*& p, const unsigned char* end) {
+        uint64_t cell;
+        if (!takeVarint(p, end, cell)) return false;
+        if (cell == 0) {
+            food.remove();
+            return true;
+        }
+        Position at;
+        if (!cellPosition(cell - 1, at) || p >= end) return false;
+        food.place(at, *p++ != 0);
+        return true;
+    }
+
+    // Header bytes: 0 while incomplete, -1 when they are not a stream.
+    long readHeader(const unsigned char* begin, const unsigned char* end) {
+        if (end - begin < static_cast<long>(sizeof(SPECTATE_MAGIC))) return 0;
+        if (std::memcmp(begin, SPECTATE_MAGIC, sizeof(SPECTATE_MAGIC)) != 0) return -1;
+        const unsigned char* p = begin + sizeof(SPECTATE_MAGIC);
+        uint64_t version;
+        if (!takeVarint(p, end, version)) return end - begin > 64 ? -1 : 0;
+        if (version != SPECTATE_VERSION) return -1;
+        int* fields[7] = { &config.width, &config.height, &config.specialFoodPercent, &config.pointsPerLevel,
+                           &config.baseTickMs, &config.tickMsPerLevel, &config.minTickMs };
+        for (int* field : fields) {
+            uint64_t value;
+            if (!takeVarint(p, end, value)) return end - begin > 64 ? -1 : 0;
+            if (value > 0x7FFFFFFF) return -1;
+            *field = static_cast<int>(value);
+        }
+        if (config.width < 4 || config.height < 1 || config.pointsPerLevel < 1 ||
+            static_cast<long long>(config.width) * config.height > MAX_BOARD_CELLS) {
+            return -1;
+        }
+        return p - begin;
+    }
+
+    bool applyKeyframe(const unsigned char* p, const unsigned char* end) {
+        uint64_t scoreValue, heading, length, tailCell;
+        if (p >= end) return false;
+        int flags = *p++;
+        if (!takeVarint(p, end, scoreValue) || !readFood(p, end) || !takeVarint(p, end, heading) ||
+            !takeVarint(p, end, length) || heading > STOP ||
+            length > static_cast<uint64_t>(config.width) * config.height) {
+            return false;
+        }
+        snake.clearBody();
+        if (length > 0) {
+            Position at;
+            if (!takeVarint(p, end, tailCell) || !cellPosition(tailCell, at)) return false;
+            if (static_cast<uint64_t>(end - p) < length / 4) return false;
+            snake.pushHead(at);
+            for (uint64_t k = 1; k < length; k++) {
+                size_t byte = static_cast<size_t>((k - 1) / 4);
+                if (p + byte >= end) return false;
+                at = stepFrom(at, static_cast<Direction>((p[byte] >> (((k - 1) % 4) * 2)) & 3));
+                if (!snake.getOccupancy().contains(at)) return false;
+                snake.pushHead(at);
+            }
+        }
+        snake.forceDirection(static_cast<Direction>(heading));
+        score = static_cast<int>(std::min<uint64_t>(scoreValue, 0x7FFFFFFF));
+        over = (flags & TICK_OVER) != 0;
+        won = (flags & TICK_WON) != 0;
+        synced = true;
+        repaint = true;
+        return true;
+    }
+
+    bool applyTick(const unsigned char* p, const unsigned char* end) {
+        if (p >= end || !synced) return false;
+        int flags = *p++;
+        if (flags & TICK_HEAD) {
+            if (p >= end || *p > RIGHT || snake.getLength() == 0) return false;
+            Direction dir = static_cast<Direction>(*p++);
+            Position head = stepFrom(snake.getHead(), dir);
+            if (!snake.getOccupancy().contains(head)) return false;
+            if ((flags & TICK_POP) == 0 && snake.getLength() > config.width * config.height) return false;
+            snake.forceDirection(dir);
+            snake.mirrorMove(head, (flags & TICK_POP) != 0);
+        }
+        if ((flags & TICK_FOOD) && !readFood(p, end)) return false;
+        if (flags & TICK_SCORE) {
+            uint64_t value;
+            if (!takeVarint(p, end, value)) return false;
+            score = static_cast<int>(std::min<uint64_t>(value, 0x7FFFFFFF));
+        }
+        if (flags & TICK_OVER) {
+            over = true;
+            won = (flags & TICK_WON) != 0;
+        }
+        return true;
+    }
+
+public:
+    SpectatorMirror()
+        : snake(4, 1), score(0), over(false), won(false), hasHeader(false), synced(false), repaint(false) {}
+
+    // Applies every complete message in the bytes received so far. False
+    // once the stream turns out to be corrupt; getError() says why.
+    bool feed(const unsigned char* data, size_t size) {
+        pending.insert(pending.end(), data, data + size);
+        const unsigned char* begin = pending.data();
+        const unsigned char* end = begin + pending.size();
+        const unsigned char* p = begin;
+        if (!hasHeader) {
+            long used = readHeader(p, end);
+            if (used < 0) return fail("not a spectator stream");
+            if (used == 0) return true;
+            p += used;
+            snake = Snake(config.width, config.height);
+            hasHeader = true;
+        }
+        // A keyframe is at most two bits per cell plus a few varints.
+        const uint64_t maxMessage = static_cast<uint64_t>(config.width) * config.height / 4 + 64;
+        while (p < end) {
+            const unsigned char* start = p;
+            uint64_t length;
+            if (!takeVarint(p, end, length)) {
+                if (end - start > 10) return fail("corrupt message length");
+                p = start;
+                break;
+            }
+            if (length == 0 || length > maxMessage) return fail("corrupt message length");
+            if (static_cast<uint64_t>(end - p) < length) {
+                p = start;
+                break;
+            }
+            const unsigned char* body = p;
+            p += length;
+            bool ok = body[0] == SPECTATE_KEYFRAME ? applyKeyframe(body + 1, p)
+                    : body[0] == SPECTATE_TICK ? applyTick(body + 1, p) : false;
+            if (!ok) return fail("corrupt message");
+        }
+        pending.erase(pending.begin(), pending.begin() + (p - begin));
+        return true;
+    }
+
+    bool hasConfig() const { return hasHeader; }
+    // True from the first keyframe on; before it there is nothing to draw.
+    bool isSynced() const { return synced; }
+    const SimulationConfig& getConfig() const { return config; }
+    const Snake& getSnake() const { return snake; }
+    const Food& getFood() const { return food; }
+    int getScore() const { return score; }
+    int getLevel() const { return score / config.pointsPerLevel + 1; }
+    bool isOver() const { return over; }
+    bool hasWon() const { return won; }
+    const std::string& getError() const { return error; }
+
+    // True once after each keyframe: the view starts over from it.
+    bool consumeRepaint() {
+        bool was = repaint;
+        repaint = false;
+        return was;
+    }
+};
+
+#ifdef __linux__
+// ---------------------------- Spectator Server ----------------------------
+// Plays one game headless and streams it to any number of viewers from one
+// thread and one epoll set. Everything since the last keyframe is a single
+// shared buffer: a tick is appended once for all viewers, then each viewer
+// gets one sendmsg() of whatever it has not had yet, so nothing is copied
+// per viewer. A keyframe starts the buffer over every KEYFRAME_TICKS ticks
+// and at each new game. Viewers that are keeping up skip it. A viewer that
+// is behind finishes the message it is in the middle of, drops the ticks
+// it never read and goes on from the keyframe: a slow viewer costs one
+// keyframe interval of memory at most and never holds up the others.
+class SpectatorServer {
+public:
+    static const int KEYFRAME_TICKS = 64;
+    static const int RESTART_TICKS = 10;   // the end stays on screen this long
+
+private:
+    struct Viewer {
+        int fd;
+        uint32_t serial;      // tells a reused fd from the viewer it replaced
+        size_t offset;        // bytes of the stream already sent
+        std::string carry;    // sent ahead of the stream: the header, or the end of a cut message
+        size_t carrySent;
+    };
+
+    static const uint64_t LISTEN_TAG = ~uint64_t(0);
+
+    SimulationState sim;
+    Pcg32 rng;
+    bool autopilot;
+    SpectatorEncoder encoder;
+    std::string header;
+    std::string stream;
+    std::vector<size_t> ends;     // where each message of the stream ends
+    std::string next;             // the keyframe being started
+    int ticksSinceKeyframe;
+    int restartIn;
+    int listenFd, epollFd;
+    bool listening;
+    std::vector<Viewer> viewers;
+    std::vector<int> slotOf;      // by fd: index in viewers, or -1
+    uint32_t nextSerial;
+    long long games, skips, bytesSent;
+    std::string error;
+
+    bool fail(const char* what) {
+        error = std::string(what) + ": " + std::strerror(errno);
+        return false;
+    }
+
+    void setListening(bool on) {
+        if (on == listening) return;
+        epoll_event event;
+        event.events = EPOLLIN;
+        event.data.u64 = LISTEN_TAG;
+        epoll_ctl(epollFd, on ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, listenFd, &event);
+        listening = on;
+    }
+
+    // One sendmsg() for the carry and the unsent stream. False when the
+    // viewer has gone away.
+    bool flush(Viewer& v) {
+        iovec parts[2];
+        int count = 0;
+        if (v.carrySent < v.carry.size()) {
+            parts[count].iov_base = &v.carry[v.carrySent];
+            parts[count++].iov_len = v.carry.size() - v.carrySent;
+        }
+        if (v.offset < stream.size()) {
+            parts[count].iov_base = &stream[v.offset];
+            parts[count++].iov_len = stream.size() - v.offset;
+        }
+        if (count == 0) return true;
+        msghdr message;
+        std::memset(&message, 0, sizeof(message));
+        message.msg_iov = parts;
+        message.msg_iovlen = count;
+        ssize_t n = ::sendmsg(v.fd, &message, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        size_t sent = static_cast<size_t>(n);
+        bytesSent += n;
+        size_t fromCarry = std::min(sent, v.carry.size() - v.carrySent);
+        v.carrySent += fromCarry;
+        v.offset += sent - fromCarry;
+        if (v.carrySent == v.carry.size()) {
+            v.carry.clear();
+            v.carrySent = 0;
+        }
+        return true;
+    }
+
+    void drop(size_t slot) {
+        int fd = viewers[slot].fd;
+        ::close(fd);
+        slotOf[fd] = -1;
+        if (slot + 1 < viewers.size()) {
+            viewers[slot] = std::move(viewers.back());
+            slotOf[viewers[slot].fd] = static_cast<int>(slot);
+        }
+        viewers.pop_back();
+        setListening(true);
+    }
+
+    void acceptViewers() {
+        while (true) {
+            int fd = ::accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                // Out of descriptors: stop accepting until a viewer leaves.
+                if (errno == EMFILE || errno == ENFILE) setListening(false);
+                return;
+            }
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            Viewer v;
+            v.fd = fd;
+            v.serial = nextSerial++;
+            v.offset = 0;
+            v.carry = header;
+            v.carrySent = 0;
+            epoll_event event;
+            event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            event.data.u64 = static_cast<uint64_t>(v.serial) << 32 | static_cast<uint32_t>(fd);
+            if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) != 0) {
+                ::close(fd);
+                continue;
+            }
+            if (static_cast<size_t>(fd) >= slotOf.size()) slotOf.resize(static_cast<size_t>(fd) + 1, -1);
+            slotOf[fd] = static_cast<int>(viewers.size());
+            viewers.push_back(std::move(v));
+        }
+    }
+
+    void handle(const epoll_event& event) {
+        if (event.data.u64 == LISTEN_TAG) {
+            acceptViewers();
+            return;
+        }
+        int fd = static_cast<int>(event.data.u64 & 0xFFFFFFFFu);
+        uint32_t serial = static_cast<uint32_t>(event.data.u64 >> 32);
+        if (static_cast<size_t>(fd) >= slotOf.size() || slotOf[fd] < 0) return;
+        size_t slot = static_cast<size_t>(slotOf[fd]);
+        if (viewers[slot].serial != serial) return;
+        bool gone = (event.events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) != 0;
+        if (!gone && (event.events & EPOLLIN)) {
+            // Viewers have nothing to say; reading only notices them leave.
+            char sink[256];
+            ssize_t n;
+            while ((n = ::read(fd, sink, sizeof(sink))) > 0) {}
+            gone = n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR);
+        }
+        if (!gone && (event.events & EPOLLOUT)) gone = !flush(viewers[slot]);
+        if (gone) drop(slot);
+    }
+
+    // Starts the stream over at a keyframe of the current position.
+    // `continues`: the position follows on from the last tick sent (rather
+    // than being a new game), so viewers that have every tick skip it.
+    void startKeyframe(bool continues) {
+        next.clear();
+        encoder.keyframe(sim, next);
+        for (Viewer& v : viewers) {
+            bool current = v.carrySent == v.carry.size() && v.offset == stream.size();
+            if (current) {
+                v.offset = continues ? next.size() : 0;
+                continue;
+            }
+            // Behind: keep the rest of the message in flight, drop the others.
+            std::vector<size_t>::const_iterator end = std::lower_bound(ends.begin(), ends.end(), v.offset);
+            if (v.offset > 0 && end != ends.end() && *end != v.offset) v.carry.append(stream, v.offset, *end - v.offset);
+            v.offset = 0;
+            skips++;
+        }
+        stream.swap(next);
+        ends.assign(1, stream.size());
+        ticksSinceKeyframe = 0;
+    }
+
+    void tick() {
+        if (sim.isOver()) {
+            if (--restartIn > 0) return;
+            games++;
+            std::printf("serve: game=%lld score=%d length=%d ticks=%lld viewers=%zu skips=%lld sent_kb=%lld\n",
+                        games, sim.getScore(), sim.getSnake().getLength(), sim.getTicks(), viewers.size(),
+                        skips, bytesSent / 1024);
+            std::fflush(stdout);
+            sim.reset();
+            startKeyframe(false);
+        } else {
+            if (ticksSinceKeyframe >= KEYFRAME_TICKS) startKeyframe(true);
+            Direction action = autopilot ? autopilotPolicy(sim, rng) : safeRandomPolicy(sim, rng);
+            StepOutcome outcome = sim.step(action);
+            if (outcome == STEP_IDLE) return;
+            encoder.tick(sim, outcome, stream);
+            ends.push_back(stream.size());
+            ticksSinceKeyframe++;
+            if (sim.isOver()) restartIn = RESTART_TICKS;
+        }
+        // Back to front, so a viewer dropped here swaps in one already sent to.
+        for (size_t i = viewers.size(); i-- > 0;) {
+            if (!flush(viewers[i])) drop(i);
+        }
+    }
+
+public:
+    SpectatorServer(const SimulationConfig& config, uint64_t seed, bool useAutopilot)
+        : sim(config, seed), rng(seed, 0x5EE), autopilot(useAutopilot), ticksSinceKeyframe(0), restartIn(0),
+          listenFd(-1), epollFd(-1), listening(false), nextSerial(1), games(0), skips(0), bytesSent(0) {
+        SpectatorEncoder::header(config, header);
+        encoder.keyframe(sim, stream);
+        ends.assign(1, stream.size());
+    }
+
+    ~SpectatorServer() {
+        for (const Viewer& v : viewers) ::close(v.fd);
+        if (listenFd >= 0) ::close(listenFd);
+        if (epollFd >= 0) ::close(epollFd);
+    }
+
+    bool listen(int port) {
+        listenFd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listenFd < 0) return fail("socket");
+        int one = 1;
+        setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in address;
+        std::memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_ANY);
+        address.sin_port = htons(static_cast<uint16_t>(port));
+        if (::bind(listenFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) return fail("bind");
+        if (::listen(listenFd, SOMAXCONN) != 0) return fail("listen");
+        epollFd = ::epoll_create1(EPOLL_CLOEXEC);
+        if (epollFd < 0) return fail("epoll_create1");
+        setListening(true);
+        return true;
+    }
+
+    const std::string& getError() const { return error; }
+
+    // Ticks at the game's own speed times `speed`, forever. At most one tick
+    // per pass, and every pass polls the sockets, so however fast the game
+    // runs viewers still get accepted, read and flushed.
+    void run(double speed) {
+        typedef std::chrono::steady_clock Clock;
+        epoll_event events[256];
+        Clock::time_point due = Clock::now();
+        while (true) {
+            Clock::time_point now = Clock::now();
+            if (now >= due) {
+                tick();
+                Clock::duration period = std::chrono::duration_cast<Clock::duration>(
+                    std::chrono::duration<double, std::milli>(sim.getTickMs() / speed));
+                // After a stall, carry on from now rather than catch up.
+                due = std::max(due + period, now);
+                now = Clock::now();
+            }
+            long long waitUs = now >= due ? 0
+                : std::chrono::duration_cast<std::chrono::microseconds>(due - now).count();
+            int n = ::epoll_wait(epollFd, events, 256, static_cast<int>((waitUs + 999) / 1000));
+            for (int i = 0; i < n; i++) handle(events[i]);
+        }
+    }
+};
+#endif // __linux__
+
+// ---------------------------- Frame Timing ----------------------------
+// How late the game loop wakes up relative to the deadline it slept for.
+struct FrameJitter {
+    long long samples;
+    double sumMs;
+    double worstMs;
+
+    FrameJitter() : samples(0), sumMs(0.0), worstMs(0.0) {}
+
+    void record(std::chrono::steady_clock::duration late) {
+        double ms = std::chrono::duration<double, std::milli>(late).count();
+        samples++;
+        sumMs += ms;
+        worstMs = std::max(worstMs, ms);
+    }
+
+    double meanMs() const { return samples ? sumMs / samples : 0.0; }
+    double maxMs() const { return worstMs; }
+};
+
+// Fixed-bucket histogram: four linear sub-buckets per power of two, so any
+// value up to 2^64 is recorded in O(1) with at most ~19% bucket width and
+// percentiles read straight off 256 counters.
+class Histogram {
+private:
+    static const int BUCKETS = 256;
+    uint64_t counts[BUCKETS];
+    uint64_t total;
+    uint64_t sum;
+    uint64_t largest;
+
+    static int floorLog2(uint64_t v) {
+#if defined(__GNUC__) || defined(__clang__)
+        return 63 - __builtin_clzll(v);
+#else
+        int log = 0;
+        while (v >>= 1) log++;
+        return log;
+#endif
+    }
+
+    static int bucketOf(uint64_t v) {
+        if (v < 4) return static_cast<int>(v);
+        int log = floorLog2(v);
+        return (log - 1) * 4 + static_cast<int>((v >> (log - 2)) & 3);
+    }
+
+    static uint64_t bucketLow(int b) {
+        if (b < 4) return static_cast<uint64_t>(b);
+        int log = b / 4 + 1;
+        return static_cast<uint64_t>(4 + b % 4) << (log - 2);
+    }
+
+public:
+    Histogram() { clear(); }
+
+    void clear() {
+        std::fill(counts, counts + BUCKETS, 0);
+        total = sum = largest = 0;
+    }
+
+    void record(uint64_t value) {
+        counts[bucketOf(value)]++;
+        total++;
+        sum += value;
+        largest = std::max(largest, value);
+    }
+
+    uint64_t count() const { return total; }
+    uint64_t max() const { return largest; }
+    double mean() const { return total ? static_cast<double>(sum) / total : 0.0; }
+
+    // Upper edge of the bucket holding the q-quantile, clamped to the max.
+    uint64_t percentile(double q) const {
+        if (total == 0) return 0;
+        uint64_t rank = static_cast<uint64_t>(q * total);
+        if (rank >= total) rank = total - 1;
+        uint64_t seen = 0;
+        for (int b = 0; b < BUCKETS; b++) {
+            seen += counts[b];
+            if (seen > rank) return std::min(largest, b + 1 < BUCKETS ? bucketLow(b + 1) - 1 : largest);
+        }
+        return largest;
+    }
+};
+
+enum ProfilePhase { PHASE_INPUT, PHASE_UPDATE, PHASE_RENDER, PHASE_PRESENT, PHASE_SLEEP, PHASE_COUNT };
+
+// Per-phase latency of the game loop plus terminal output per frame. When
+// disabled every call is a single branch.
+class FrameProfiler {
+private:
+    bool enabled;
+    Histogram phases[PHASE_COUNT];
+    Histogram bytesPerFrame;
+    Histogram writesPerFrame;
+
+    static const char* phaseName(int phase) {
+        static const char* const names[PHASE_COUNT] = { "input", "update", "render", "present", "sleep" };
+        return names[phase];
+    }
+
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    // Times one phase from construction to destruction.
+    class Scope {
+    private:
+        FrameProfiler& profiler;
+        ProfilePhase phase;
+        Clock::time_point start;
+    public:
+        Scope(FrameProfiler& p, ProfilePhase ph) : profiler(p), phase(ph) {
+            if (profiler.enabled) start = Clock::now();
+        }
+        ~Scope() {
+            if (profiler.enabled) profiler.add(phase, Clock::now() - start);
+        }
+    };
+
+    FrameProfiler() : enabled(false) {}
+
+    void enable(bool on) { enabled = on; }
+    bool isEnabled() const { return enabled; }
+
+    void add(ProfilePhase phase, Clock::duration elapsed) {
+        if (!enabled) return;
+        phases[phase].record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+    }
+
+    void addFrame(size_t bytes, int writes) {
+        if (!enabled) return;
+        bytesPerFrame.record(bytes);
+        writesPerFrame.record(static_cast<uint64_t>(writes));
+    }
+
+    const Histogram& phase(ProfilePhase p) const { return phases[p]; }
+    const Histogram& bytes() const { return bytesPerFrame; }
+    const Histogram& writes() const { return writesPerFrame; }
+
+    static const char* name(ProfilePhase p) { return phaseName(p); }
+
+    bool writeJson(const std::string& path) const {
+        FILE* file = std::fopen(path.c_str(), "w");
+        if (!file) return false;
+        std::fprintf(file, "{\n  \"frames\": %llu,\n  \"phases_us\": {\n",
+                     static_cast<unsigned long long>(bytesPerFrame.count()));
+        for (int p = 0; p < PHASE_COUNT; p++) {
+            const Histogram& h = phases[p];
+            std::fprintf(file, "    \"%s\": {\"count\": %llu, \"mean\": %.3f, \"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f}%s\n",
+                         phaseName(p), static_cast<unsigned long long>(h.count()), h.mean() / 1000.0,
+                         h.percentile(0.50) / 1000.0, h.percentile(0.99) / 1000.0, h.max() / 1000.0,
+                         p + 1 < PHASE_COUNT ? "," : "");
+        }
+        std::fprintf(file, "  },\n");
+        const Histogram* perFrame[2] = { &bytesPerFrame, &writesPerFrame };
+        const char* perFrameName[2] = { "bytes_per_frame", "writes_per_frame" };
+        for (int i = 0; i < 2; i++) {
+            const Histogram& h = *perFrame[i];
+            std::fprintf(file, "  \"%s\": {\"mean\": %.2f, \"p50\": %llu, \"p99\": %llu, \"max\": %llu}%s\n",
+                         perFrameName[i], h.mean(), static_cast<unsigned long long>(h.percentile(0.50)),
+                         static_cast<unsigned long long>(h.percentile(0.99)),
+                         static_cast<unsigned long long>(h.max()), i == 0 ? "," : "");
+        }
+        std::fprintf(file, "}\n");
+        return std::fclose(file) == 0;
+    }
+};
+
+// ---------------------------- GameBoard (visual heavy) ----------------------------
+// The screen's panels and overlays, in drawing order. Each is drawn only
+// while its region is dirty: not drawn yet, invalidated (layout, repaint),
+// uncovered by an overlay going away, or drawn over by a widget before it
+// in this order. Values shown inside a panel (the stats) are cached per
+// line and redrawn when they change.
+enum UiWidget {
+    UI_TITLE, UI_BORDER, UI_STATS, UI_CONTROLS, UI_LEGEND, UI_PROFILE,
+    UI_PAUSE, UI_GAME_OVER,   // overlays: opaque, shown and hidden by the caller
+    UI_WIDGET_COUNT
+};
+
+struct UiRegion {
+    int x, y, width, height;   // screen cells
+    bool dirty;
+    bool shown;                // panels always; overlays while on screen
+
+    UiRegion() : x(0), y(0), width(0), height(0), dirty(true), shown(false) {}
+
+    void place(int px, int py, int w, int h) {
+        x = px;
+        y = py;
+        width = w;
+        height = h;
+        dirty = true;
+    }
+
+    bool contains(int cx, int cy) const { return cx >= x && cx < x + width && cy >= y && cy < y + height; }
+    bool overlaps(const UiRegion& o) const {
+        return x < o.x + o.width && o.x < x + width && y < o.y + o.height && o.y < y + height;
+    }
+};
+
+class GameBoard {
+private:
+    int width, height;
+    int viewWidth, viewHeight;   // board cells visible on screen
+    int cameraX, cameraY;        // board cell at the top-left of the view
+    int panelX, panelY;          // top-left of the stats/controls/legend column
+    UiRegion regions[UI_WIDGET_COUNT];
+    UiRegion viewDamage;         // screen cells of the view to repaint, while dirty
+    bool snakeDrawn;
+    int lastScore;
+    int lastHighScore;
+    int lastLength;
+    std::string lastLevel;
+    long long lastArenaTick;
+
+    static int fitView(int world, int available) {
+        return std::min(world, std::max(MIN_VIEW, available));
+    }
+
+    // Recentres one axis when p gets within a quarter view of an edge.
+    static int scrollAxis(int camera, int p, int view, int world) {
+        int margin = view / 4;
+        if (p < camera + margin || p >= camera + view - margin) camera = p - view / 2;
+        return std::max(0, std::min(camera, world - view));
+    }
+
+    static bool isOverlay(int id) { return id >= UI_PAUSE; }
+
+    bool inView(const Position& pos) const {
+        return pos.x >= cameraX && pos.x < cameraX + viewWidth &&
+               pos.y >= cameraY && pos.y < cameraY + viewHeight;
+    }
+
+    bool underOverlay(int x, int y) const {
+        for (int id = UI_PAUSE; id < UI_WIDGET_COUNT; id++) {
+            if (regions[id].shown && regions[id].contains(x, y)) return true;
+        }
+        return false;
+    }
+
+    // Something was drawn into `area`: the widgets after `id` that it
+    // overlaps are drawn again on top of it.
+    void drewOver(int id, const UiRegion& area) {
+        for (int later = id + 1; later < UI_WIDGET_COUNT; later++) {
+            if (regions[later].shown && regions[later].overlaps(area)) regions[later].dirty = true;
+        }
+    }
+
+    void finishDrawing(UiWidget id) {
+        regions[id].dirty = false;
+        drewOver(id, regions[id]);
+    }
+
+    void blank(const UiRegion& area) {
+        FrameBuffer& frame = Console::frame();
+        frame.setColor(WHITE);
+        for (int row = 0; row < area.height; row++) {
+            frame.moveTo(area.x, area.y + row);
+            for (int col = 0; col < area.width; col++) frame.put(' ');
+        }
+    }
 
-        Console::setColor(GREEN);
-        for (size_t i = 1; i < currentBody.size(); i++) {
-            Position segment = currentBody[i];
-            if (isValidPosition(segment)) {
-                Console::gotoxy(segment.x + 1, segment.y + 4);
-                std::cout << 'o';
+    UiRegion viewArea() const {
+        UiRegion area;
+        area.place(1, 4, viewWidth, viewHeight);
+        return area;
+    }
+
+    // Repaints the visible cells of `area` (screen cells, clipped to the
+    // view) from the occupancy grid: O(area), no matter how long the snake
+    // is or how big the board. Overlays over it are drawn again.
+    void drawVisible(const OccupancyGrid& grid, const UiRegion& area) {
+        int left = std::max(area.x - 1, 0), right = std::min(area.x + area.width - 1, viewWidth);
+        int top = std::max(area.y - 4, 0), bottom = std::min(area.y + area.height - 4, viewHeight);
+        FrameBuffer& frame = Console::frame();
+        frame.setColor(GREEN);
+        for (int row = top; row < bottom; row++) {
+            frame.moveTo(1 + left, 4 + row);
+            for (int col = left; col < right; col++) {
+                frame.put(grid.isOccupied(Position(cameraX + col, cameraY + row)) ? 'o' : ' ');
+            }
+        }
+        drewOver(UI_BORDER, area);
+    }
+
+    void line(int x, int y, int color, const char* text) {
+        Console::setColor(color);
+        Console::gotoxy(x, y);
+        Console::out() << text;
+    }
+
+    void drawTitle() {
+        line(0, 0, LIGHT_CYAN, "+========================================================+");
+        line(0, 1, LIGHT_CYAN, "|                    SNAKE GAME                          |");
+        line(0, 2, LIGHT_CYAN, "+========================================================+");
+        finishDrawing(UI_TITLE);
+    }
+
+    void drawControls() {
+        static const char* const keys[] = {
+            "| W/UP - Move Up             |", "| S/DOWN - Move Down         |",
+            "| A/LEFT - Move Left         |", "| D/RIGHT - Move Right       |",
+            "| P - Pause Game             |", "| Q - Quit Game              |",
+            "| C - Autopilot On/Off       |",
+        };
+        line(panelX, panelY + 7, LIGHT_MAGENTA, "+--------- CONTROLS ---------+");
+        for (int i = 0; i < 7; i++) line(panelX, panelY + 8 + i, WHITE, keys[i]);
+        line(panelX, panelY + 15, LIGHT_MAGENTA, "+----------------------------+");
+        finishDrawing(UI_CONTROLS);
+    }
+
+    void drawLegend() {
+        line(panelX, panelY + 16, CYAN, "+------ FOOD TYPES ------+");
+        line(panelX, panelY + 17, LIGHT_RED, "| * ");
+        Console::setColor(WHITE);
+        Console::out() << "- Normal Food (+10) |";
+        line(panelX, panelY + 18, LIGHT_YELLOW, "| $ ");
+        Console::setColor(WHITE);
+        Console::out() << "- Special Food (+50) |";
+        line(panelX, panelY + 19, CYAN, "+------------------------+");
+        finishDrawing(UI_LEGEND);
+    }
+
+public:
+    static const int PANEL_WIDTH = 31;
+    static const int PANEL_ROWS = 20;
+    static const int MIN_VIEW = 10;
+
+    GameBoard(int w = 30, int h = 20)
+        : width(w), height(h), viewWidth(w), viewHeight(h), cameraX(0), cameraY(0),
+          panelX(w + 5), panelY(5), snakeDrawn(false),
+          lastScore(-1), lastHighScore(-1), lastLength(-1),
+          lastLevel(""), lastArenaTick(-1) {
+        viewDamage.dirty = false;
+        placeRegions();
+    }
+
+    int getWidth() const { return width; }
+    int getHeight() const { return height; }
+    int getViewWidth() const { return viewWidth; }
+    int getViewHeight() const { return viewHeight; }
+
+    // Screen size that shows the board (or a generous view of a big one)
+    // and the panel beside it.
+    int preferredScreenWidth() const { return std::max(80, std::min(width, 160) + 5 + PANEL_WIDTH); }
+    int preferredScreenHeight(bool withProfile) const {
+        return std::max(withProfile ? 34 : 30, std::min(height, 50) + 6);
+    }
+
+    // Sizes the view to the screen, with the panel right of it when at
+    // least MIN_VIEW columns are left for the board and under it otherwise.
+    // Call resetDrawnFlags() afterwards to repaint.
+    void layout(int screenWidth, int screenHeight) {
+        if (screenWidth - 5 - PANEL_WIDTH >= std::min(width, MIN_VIEW)) {
+            viewWidth = fitView(width, screenWidth - 5 - PANEL_WIDTH);
+            viewHeight = fitView(height, screenHeight - 5);
+            panelX = viewWidth + 5;
+            panelY = 5;
+        } else {
+            viewWidth = fitView(width, screenWidth - 2);
+            viewHeight = fitView(height, screenHeight - 6 - PANEL_ROWS);
+            panelX = 0;
+            panelY = viewHeight + 6;
+        }
+        cameraX = std::max(0, std::min(cameraX, width - viewWidth));
+        cameraY = std::max(0, std::min(cameraY, height - viewHeight));
+        placeRegions();
+    }
+
+    void placeRegions() {
+        regions[UI_TITLE].place(0, 0, 58, 3);
+        regions[UI_BORDER].place(0, 3, viewWidth + 2, viewHeight + 2);
+        regions[UI_STATS].place(panelX, panelY, PANEL_WIDTH, 6);
+        regions[UI_CONTROLS].place(panelX, panelY + 7, PANEL_WIDTH, 9);
+        regions[UI_LEGEND].place(panelX, panelY + 16, PANEL_WIDTH, 4);
+        regions[UI_PROFILE].place(panelX, panelY + 21, PANEL_WIDTH, 7);
+        for (int id = 0; id < UI_PAUSE; id++) regions[id].shown = true;
+    }
+
+    void drawBorder() {
+        if (!regions[UI_BORDER].dirty) return;
+        Console::setColor(CYAN);
+        Console::gotoxy(0, 3);
+        Console::out() << "+";
+        for (int i = 0; i < viewWidth; i++) Console::out() << "-";
+        Console::out() << "+";
+
+        for (int i = 0; i < viewHeight; i++) {
+            Console::gotoxy(0, 4 + i);
+            Console::out() << "|";
+            Console::gotoxy(viewWidth + 1, 4 + i);
+            Console::out() << "|";
+        }
+
+        Console::gotoxy(0, 4 + viewHeight);
+        Console::out() << "+";
+        for (int i = 0; i < viewWidth; i++) Console::out() << "-";
+        Console::out() << "+";
+        finishDrawing(UI_BORDER);
+    }
+
+    // Normally only the cells the last move touched are drawn: the vacated
+    // tail, the old head (now a body segment) and the new head. The whole
+    // view is repainted after resetDrawnFlags() or invalidateView() and
+    // whenever the camera scrolls to keep the head in view; the cells an
+    // overlay leaves are repainted on their own.
+    void drawSnake(const Snake& snake) {
+        const BodyRing& currentBody = snake.getBody();
+        const MoveDelta& delta = snake.getLastMove();
+
+        if (!currentBody.empty()) {
+            int x = scrollAxis(cameraX, currentBody[0].x, viewWidth, width);
+            int y = scrollAxis(cameraY, currentBody[0].y, viewHeight, height);
+            if (x != cameraX || y != cameraY) {
+                cameraX = x;
+                cameraY = y;
+                snakeDrawn = false;
+            }
+        }
+
+        if (!snakeDrawn) {
+            drawVisible(snake.getOccupancy(), viewArea());
+            snakeDrawn = true;
+        } else {
+            if (viewDamage.dirty) drawVisible(snake.getOccupancy(), viewDamage);
+            if (delta.moved) {
+                if (delta.tailVacated) drawCell(delta.vacatedTail, ' ');
+                if (currentBody.size() > 1) {
+                    Console::setColor(GREEN);
+                    drawCell(currentBody[1], 'o');
+                }
             }
         }
+        viewDamage.dirty = false;
+
+        if (!currentBody.empty()) {
+            Console::setColor(LIGHT_GREEN);
+            drawCell(currentBody[0], headGlyph(snake.getDirection()));
+        }
+    }
+
+    static char headGlyph(Direction dir) {
+        switch (dir) {
+            case UP: return '^';
+            case DOWN: return 'v';
+            case LEFT: return '<';
+            case RIGHT: return '>';
+            default: return '@';
+        }
+    }
+
+    // Board coordinates; cells outside the view or under an overlay are
+    // skipped.
+    void drawCell(const Position& pos, char glyph) {
+        if (!inView(pos)) return;
+        int x = pos.x - cameraX + 1, y = pos.y - cameraY + 4;
+        if (underOverlay(x, y)) return;
+        Console::gotoxy(x, y);
+        Console::out() << glyph;
     }
 
     void drawFood(const Food& food) {
-        Position pos = food.getPosition();
-        if (isValidPosition(pos)) {
-            Console::gotoxy(pos.x + 1, pos.y + 4);
-            Console::setColor(food.getColor());
-            std::cout << food.getSymbol();
+        if (!food.isAvailable()) return;
+        Console::setColor(food.getColor());
+        drawCell(food.getPosition(), food.getSymbol());
+    }
+
+    void eraseFood(const Position& pos) { drawCell(pos, ' '); }
+
+    // Arena ticks move many snakes at once, so the view is repainted from
+    // the owner grid: O(view) per tick, and present() still sends only the
+    // cells that changed. The camera follows the player (snake 0).
+    void drawArena(const ArenaState& arena) {
+        static const int botColors[] = { LIGHT_MAGENTA, LIGHT_CYAN, LIGHT_BLUE, MAGENTA, CYAN, BLUE, GRAY };
+        const int palette = sizeof(botColors) / sizeof(botColors[0]);
+        if (snakeDrawn && !viewDamage.dirty && arena.getTicks() == lastArenaTick) return;
+        if (arena.isAlive(0)) {
+            cameraX = scrollAxis(cameraX, arena.getHead(0).x, viewWidth, width);
+            cameraY = scrollAxis(cameraY, arena.getHead(0).y, viewHeight, height);
+        }
+
+        FrameBuffer& frame = Console::frame();
+        for (int row = 0; row < viewHeight; row++) {
+            frame.moveTo(1, 4 + row);
+            for (int col = 0; col < viewWidth; col++) {
+                uint16_t on = arena.cellAt(Position(cameraX + col, cameraY + row));
+                if (on == ARENA_EMPTY) {
+                    frame.put(' ');
+                    continue;
+                }
+                if (on == ARENA_FOOD) {
+                    frame.setColor(LIGHT_RED);
+                    frame.put('*');
+                } else if (on == ARENA_SPECIAL) {
+                    frame.setColor(LIGHT_YELLOW);
+                    frame.put('$');
+                } else {
+                    frame.setColor(on == 1 ? GREEN : botColors[(on - 2) % palette]);
+                    frame.put('o');
+                }
+            }
+        }
+        drewOver(UI_BORDER, viewArea());
+        for (int i = 0; i < arena.size(); i++) {
+            if (!arena.isAlive(i) || !inView(arena.getHead(i))) continue;
+            Console::setColor(i == 0 ? LIGHT_GREEN : YELLOW);
+            drawCell(arena.getHead(i), headGlyph(arena.getDirection(i)));
+        }
+        snakeDrawn = true;
+        viewDamage.dirty = false;
+        lastArenaTick = arena.getTicks();
+    }
+
+    // The title, the stats and the static panels. Each stats line is
+    // redrawn only when its value changes.
+    void displayHeader(int score, int highScore, int length, const std::string& level) {
+        if (regions[UI_TITLE].dirty) drawTitle();
+        if (regions[UI_CONTROLS].dirty) drawControls();
+        if (regions[UI_LEGEND].dirty) drawLegend();
+
+        bool statsDirty = regions[UI_STATS].dirty;
+        if (statsDirty) {
+            line(panelX, panelY, YELLOW, "+----------- STATS -----------+");
+            line(panelX, panelY + 5, YELLOW, "+----------------------------+");
+            lastScore = lastHighScore = lastLength = -1;
+            lastLevel.clear();
+        }
+
+        if (score != lastScore) {
+            Console::gotoxy(panelX, panelY + 1);
+            Console::setColor(WHITE);
+            Console::out() << "| Score: " << std::setw(16) << score << " |";
+            lastScore = score;
+            statsDirty = true;
+        }
+
+        if (highScore != lastHighScore) {
+            Console::gotoxy(panelX, panelY + 2);
+            Console::setColor(WHITE);
+            Console::out() << "| High Score: " << std::setw(11) << highScore << " |";
+            lastHighScore = highScore;
+            statsDirty = true;
+        }
+
+        if (length != lastLength) {
+            Console::gotoxy(panelX, panelY + 3);
+            Console::setColor(WHITE);
+            Console::out() << "| Length: " << std::setw(15) << length << " |";
+            lastLength = length;
+            statsDirty = true;
+        }
+
+        if (level != lastLevel) {
+            Console::gotoxy(panelX, panelY + 4);
+            Console::setColor(WHITE);
+            Console::out() << "| Level: " << std::setw(16) << level << " |";
+            lastLevel = level;
+            statsDirty = true;
+        }
+        if (statsDirty) finishDrawing(UI_STATS);
+    }
+
+    // Optional profiler overlay under the food legend. The caller refreshes
+    // it at a low rate so it does not dominate the frames it measures; in
+    // between it is drawn only when its region is dirty.
+    void displayProfile(const FrameProfiler& profiler, bool refresh) {
+        if (!refresh && !regions[UI_PROFILE].dirty) return;
+        int x = panelX;
+        Console::setColor(LIGHT_BLUE);
+        Console::gotoxy(x, panelY + 21);
+        Console::out() << "+--- PROFILE p50/p99 us ---+";
+        Console::setColor(WHITE);
+        const ProfilePhase shown[4] = { PHASE_INPUT, PHASE_UPDATE, PHASE_RENDER, PHASE_PRESENT };
+        for (int i = 0; i < 4; i++) {
+            const Histogram& h = profiler.phase(shown[i]);
+            Console::gotoxy(x, panelY + 22 + i);
+            Console::out() << "| " << std::left << std::setw(8) << FrameProfiler::name(shown[i]) << std::right
+                           << std::setw(7) << h.percentile(0.50) / 1000 << " "
+                           << std::setw(7) << h.percentile(0.99) / 1000 << "   |";
+        }
+        Console::gotoxy(x, panelY + 26);
+        Console::out() << "| bytes/frame " << std::setw(6) << profiler.bytes().percentile(0.50)
+                       << " wr " << std::setw(3) << profiler.writes().percentile(0.50) << " |";
+        Console::setColor(LIGHT_BLUE);
+        Console::gotoxy(x, panelY + 27);
+        Console::out() << "+--------------------------+";
+        finishDrawing(UI_PROFILE);
+    }
+
+    // Puts overlay `id` over the screen cells x..x+w-1, y..y+h-1, blanked.
+    // True when the caller must draw its contents now (it was not on
+    // screen, moved, or was drawn over); then call overlayDrawn(id).
+    bool showOverlay(UiWidget id, int x, int y, int w, int h) {
+        UiRegion& overlay = regions[id];
+        if (overlay.shown && (overlay.x != x || overlay.y != y || overlay.width != w || overlay.height != h)) {
+            hideOverlay(id);
+        }
+        if (!overlay.shown) overlay.place(x, y, w, h);
+        overlay.shown = true;
+        if (overlay.dirty) blank(overlay);
+        return overlay.dirty;
+    }
+
+    void overlayDrawn(UiWidget id) { finishDrawing(id); }
+
+    // Takes overlay `id` off the screen: its cells are blanked and
+    // whatever it covered (view cells, panels, other overlays) is drawn
+    // again. Call it before the frame's other drawing, so that happens in
+    // the same frame.
+    void hideOverlay(UiWidget id) {
+        UiRegion& overlay = regions[id];
+        if (!overlay.shown) return;
+        overlay.shown = false;
+        blank(overlay);
+        for (int other = 0; other < UI_WIDGET_COUNT; other++) {
+            if (other != id && regions[other].shown && regions[other].overlaps(overlay)) regions[other].dirty = true;
         }
+        UiRegion view = viewArea();
+        if (!view.overlaps(overlay)) return;
+        if (!viewDamage.dirty) {
+            viewDamage = overlay;
+        } else {
+            int right = std::max(viewDamage.x + viewDamage.width, overlay.x + overlay.width);
+            int bottom = std::max(viewDamage.y + viewDamage.height, overlay.y + overlay.height);
+            viewDamage.x = std::min(viewDamage.x, overlay.x);
+            viewDamage.y = std::min(viewDamage.y, overlay.y);
+            viewDamage.width = right - viewDamage.x;
+            viewDamage.height = bottom - viewDamage.y;
+        }
+        viewDamage.dirty = true;
+    }
+
+    void displayPauseMessage(bool paused) {
+        if (!paused) {
+            hideOverlay(UI_PAUSE);
+            return;
+        }
+        if (!showOverlay(UI_PAUSE, viewWidth / 2 - 3, viewHeight / 2 + 4, 6, 1)) return;
+        line(viewWidth / 2 - 3, viewHeight / 2 + 4, LIGHT_YELLOW, "PAUSED");
+        overlayDrawn(UI_PAUSE);
+    }
+
+    bool isValidPosition(const Position& pos) const {
+        return pos.x >= 0 && pos.x < width && pos.y >= 0 && pos.y < height;
     }
 
-    void eraseFood(const Position& pos) {
-        if (isValidPosition(pos)) {
-            Console::gotoxy(pos.x + 1, pos.y + 4);
-            std::cout << ' ';
+    // The board's contents changed wholesale (a new game): the view is
+    // repainted; the panels keep what they show and redraw what changed.
+    void invalidateView() { snakeDrawn = false; }
+
+    // The screen was cleared or lost: everything is drawn again and no
+    // overlay is up any more.
+    void resetDrawnFlags() {
+        for (int id = 0; id < UI_WIDGET_COUNT; id++) {
+            regions[id].dirty = true;
+            if (isOverlay(id)) regions[id].shown = false;
         }
+        snakeDrawn = false;
+        viewDamage.dirty = false;
+    }
+};
+
+// Defined for std::min/std::max, which take them by reference.
+const int GameBoard::MIN_VIEW;
+
+// ---------------------------- Keyboard Input Thread ----------------------------
+enum InputCommand { CMD_UP, CMD_DOWN, CMD_LEFT, CMD_RIGHT, CMD_PAUSE, CMD_QUIT, CMD_RESTART, CMD_AUTOPILOT };
+
+// Single-producer/single-consumer ring. The producer only writes `tail`,
+// the consumer only writes `head`; acquire/release on those two indices is
+// all the synchronization needed. Capacity must be a power of two.
+template <typename T, size_t Capacity>
+class SpscRing {
+private:
+    static_assert((Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+    T slots[Capacity];
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+
+public:
+    SpscRing() : head(0), tail(0) {}
+
+    // Producer side. Returns false (dropping the item) when full.
+    bool push(const T& item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == Capacity) return false;
+        slots[t & (Capacity - 1)] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side.
+    bool pop(T& item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) return false;
+        item = slots[h & (Capacity - 1)];
+        head.store(h + 1, std::memory_order_release);
+        return true;
     }
+};
 
-    void displayHeader(int score, int highScore, int length, const std::string& level) {
-        static bool headerDrawn = false;
-        if (!headerDrawn) {
-            Console::setColor(LIGHT_CYAN);
-            Console::gotoxy(0, 0);
-            std::cout << "+========================================================+";
-            Console::gotoxy(0, 1);
-            std::cout << "|                    SNAKE GAME                          |";
-            Console::gotoxy(0, 2);
-            std::cout << "+========================================================+";
-
-            Console::setColor(YELLOW);
-            Console::gotoxy(width + 5, 5);
-            std::cout << "+----------- STATS -----------+";
-            Console::gotoxy(width + 5, 10);
-            std::cout << "+----------------------------+";
-
-            Console::setColor(LIGHT_MAGENTA);
-            Console::gotoxy(width + 5, 12);
-            std::cout << "+--------- CONTROLS ---------+";
-            Console::setColor(WHITE);
-            Console::gotoxy(width + 5, 13);
-            std::cout << "| W/UP - Move Up             |";
-            Console::gotoxy(width + 5, 14);
-            std::cout << "| S/DOWN - Move Down         |";
-            Console::gotoxy(width + 5, 15);
-            std::cout << "| A/LEFT - Move Left         |";
-            Console::gotoxy(width + 5, 16);
-            std::cout << "| D/RIGHT - Move Right       |";
-            Console::gotoxy(width + 5, 17);
-            std::cout << "| P - Pause Game             |";
-            Console::gotoxy(width + 5, 18);
-            std::cout << "| Q - Quit Game              |";
-            Console::setColor(LIGHT_MAGENTA);
-            Console::gotoxy(width + 5, 19);
-            std::cout << "+----------------------------+";
-
-            Console::setColor(CYAN);
-            Console::gotoxy(width + 5, 21);
-            std::cout << "+------ FOOD TYPES ------+";
-            Console::gotoxy(width + 5, 22);
-            Console::setColor(LIGHT_RED);
-            std::cout << "| * ";
-            Console::setColor(WHITE);
-            std::cout << "- Normal Food (+10) |";
-            Console::gotoxy(width + 5, 23);
-            Console::setColor(LIGHT_YELLOW);
-            std::cout << "| $ ";
-            Console::setColor(WHITE);
-            std::cout << "- Special Food (+50) |";
-            Console::setColor(CYAN);
-            Console::gotoxy(width + 5, 24);
-            std::cout << "+------------------------+";
+// Blocks on the keyboard in its own thread and turns keys into commands, so
+// the game loop never waits for input and no keystroke is lost between
+// ticks. Escape sequences are parsed byte by byte across reads.
+class InputThread {
+private:
+    SpscRing<InputCommand, 64> commands;
+    std::atomic<bool> running;
+    std::thread worker;
 
-            headerDrawn = true;
-        }
+#ifndef _WIN32
+    enum ParseState { KEY_NORMAL, KEY_ESCAPE, KEY_CSI };
+    ParseState parseState;
 
-        if (score != lastScore) {
-            Console::gotoxy(width + 5, 6);
-            Console::setColor(WHITE);
-            std::cout << "| Score: " << std::setw(16) << score << " |";
-            lastScore = score;
+    void feed(unsigned char ch) {
+        switch (parseState) {
+            case KEY_ESCAPE:
+                // CSI (ESC [) and SS3 (ESC O) both introduce arrow keys.
+                parseState = (ch == '[' || ch == 'O') ? KEY_CSI : KEY_NORMAL;
+                return;
+            case KEY_CSI:
+                if (ch >= 0x40 && ch <= 0x7E) {
+                    parseState = KEY_NORMAL;
+                    if (ch == 'A') commands.push(CMD_UP);
+                    else if (ch == 'B') commands.push(CMD_DOWN);
+                    else if (ch == 'C') commands.push(CMD_RIGHT);
+                    else if (ch == 'D') commands.push(CMD_LEFT);
+                }
+                return; // parameter bytes of longer sequences are skipped
+            case KEY_NORMAL:
+                if (ch == 27) {
+                    parseState = KEY_ESCAPE;
+                    return;
+                }
+                feedKey(std::tolower(ch));
+                return;
         }
+    }
+#endif
 
-        if (highScore != lastHighScore) {
-            Console::gotoxy(width + 5, 7);
-            Console::setColor(WHITE);
-            std::cout << "| High Score: " << std::setw(11) << highScore << " |";
-            lastHighScore = highScore;
+    void feedKey(int key) {
+        switch (key) {
+            case 'w': commands.push(CMD_UP); break;
+            case 's': commands.push(CMD_DOWN); break;
+            case 'a': commands.push(CMD_LEFT); break;
+            case 'd': commands.push(CMD_RIGHT); break;
+            case 'p': commands.push(CMD_PAUSE); break;
+            case 'q': commands.push(CMD_QUIT); break;
+            case 'r': commands.push(CMD_RESTART); break;
+            case 'c': commands.push(CMD_AUTOPILOT); break;
         }
+    }
 
-        if (length != lastLength) {
-            Console::gotoxy(width + 5, 8);
-            Console::setColor(WHITE);
-            std::cout << "| Length: " << std::setw(15) << length << " |";
-            lastLength = length;
+    void loop() {
+#ifdef _WIN32
+        HANDLE hIn = GetStdHandle(STD_INPUT_HANDLE);
+        INPUT_RECORD records[32];
+        while (running.load(std::memory_order_relaxed)) {
+            if (WaitForSingleObject(hIn, 50) != WAIT_OBJECT_0) continue;
+            DWORD count = 0;
+            if (!ReadConsoleInputA(hIn, records, 32, &count)) continue;
+            for (DWORD i = 0; i < count; i++) {
+                if (records[i].EventType != KEY_EVENT || !records[i].Event.KeyEvent.bKeyDown) continue;
+                switch (records[i].Event.KeyEvent.wVirtualKeyCode) {
+                    case VK_UP: commands.push(CMD_UP); break;
+                    case VK_DOWN: commands.push(CMD_DOWN); break;
+                    case VK_LEFT: commands.push(CMD_LEFT); break;
+                    case VK_RIGHT: commands.push(CMD_RIGHT); break;
+                    default: feedKey(std::tolower(static_cast<unsigned char>(records[i].Event.KeyEvent.uChar.AsciiChar)));
+                }
+            }
         }
-
-        if (level != lastLevel) {
-            Console::gotoxy(width + 5, 9);
-            Console::setColor(WHITE);
-            std::cout << "| Level: " << std::setw(16) << level << " |";
-            lastLevel = level;
+#else
+        struct pollfd input = { STDIN_FILENO, POLLIN, 0 };
+        unsigned char bytes[64];
+        while (running.load(std::memory_order_relaxed)) {
+            // The timeout only bounds how long stop() waits for us.
+            int ready = ::poll(&input, 1, 50);
+            if (ready <= 0) {
+                // A lone ESC with nothing after it was just the Escape key.
+                if (ready == 0 && parseState == KEY_ESCAPE) parseState = KEY_NORMAL;
+                continue;
+            }
+            ssize_t n = read(STDIN_FILENO, bytes, sizeof(bytes));
+            if (n <= 0) {
+                if (n == 0) Console::sleep(50); // stdin closed; idle until stopped
+                continue;
+            }
+            for (ssize_t i = 0; i < n; i++) feed(bytes[i]);
         }
+#endif
     }
 
-    void displayPauseMessage(bool paused) {
-        if (paused && !wasPaused) {
-            Console::setColor(LIGHT_YELLOW);
-            Console::gotoxy(width / 2 - 3, height / 2 + 4);
-            std::cout << "PAUSED";
-            wasPaused = true;
-        } else if (!paused && wasPaused) {
-            Console::gotoxy(width / 2 - 3, height / 2 + 4);
-            std::cout << "      "; // clear
-            wasPaused = false;
-        }
+public:
+    InputThread() : running(false) {
+#ifndef _WIN32
+        parseState = KEY_NORMAL;
+#endif
     }
+    ~InputThread() { stop(); }
 
-    bool isValidPosition(const Position& pos) const {
-        return pos.x >= 0 && pos.x < width && pos.y >= 0 && pos.y < height;
+    void start() {
+        if (running.exchange(true)) return;
+        Console::initialize();
+#ifndef _WIN32
+        tcflush(STDIN_FILENO, TCIFLUSH); // leftovers from the welcome screen
+#endif
+        worker = std::thread(&InputThread::loop, this);
     }
 
-    void resetDrawnFlags() {
-        borderDrawn = false;
-        lastScore = -1;
-        lastHighScore = -1;
-        lastLength = -1;
-        lastLevel = "";
-        wasPaused = false;
+    void stop() {
+        if (!running.exchange(false)) return;
+        if (worker.joinable()) worker.join();
     }
+
+    bool poll(InputCommand& command) { return commands.pop(command); }
 };
 
 // ---------------------------- Game (full UI, input fixed) ----------------------------
+struct GameOptions {
+    uint64_t seed;
+    SimulationConfig config;
+    std::string profilePath;   // non-empty: show the profiler and dump JSON here on exit
+    std::string recordPath;    // non-empty: record every turn here as a replay
+    std::string replayPath;    // non-empty: play this replay back instead of reading turns
+    std::string statsPath;     // non-empty: high scores and finished games are kept here
+    std::string savePath;      // non-empty: resume the game saved here, save it here on quit
+    double speed;              // tick rate multiplier for replay playback, 0 < speed <= MAX_SPEED
+    int maxFps;                // frames sent to the terminal per second, at most
+    bool autopilot;            // the Autopilot steers; C toggles it in game
+    int arenaSnakes;           // > 0: an arena with this many snakes, the player and bots
+
+    GameOptions() : seed(0), speed(1.0), maxFps(60), autopilot(false), arenaSnakes(0) {}
+
+    static constexpr double MAX_SPEED = 1000.0;
+};
+
 class Game {
 private:
-    Snake snake;
-    Food food;
+    SimulationState sim;
     GameBoard board;
-    int score;
     int highScore;
-    bool gameOver;
     bool gameRunning;
     bool paused;
-    int gameSpeed;
+    GameOptions options;
+    InputThread input;
+    ReplayWriter recorder;
+    ReplayPlayer player;
+    bool replaying;
+    StatsStore stats;
+    std::chrono::steady_clock::time_point episodeStart;
+    Autopilot pilot;
+    bool autopilotUsed;        // this game had the autopilot on at some point
+    std::unique_ptr<ArenaState> arena;   // set in arena mode, which replaces sim
+    std::vector<Direction> arenaActions;
+    Pcg32 botRng;
+    FrameJitter jitter;
+    FrameProfiler profiler;
+    long long framesPresented;
+    // Turns typed faster than the snake moves wait here, one per tick.
+    static const int MAX_QUEUED_TURNS = 3;
+    Direction queuedTurns[MAX_QUEUED_TURNS];
+    int queuedTurnCount;
     std::string currentLevel;
-    Position oldFoodPos;
-    bool foodEaten;
+
+    // The player's game, from sim or the arena.
+    int score() const { return arena ? arena->getScore(0) : sim.getScore(); }
+    int length() const { return arena ? arena->getLength(0) : sim.getSnake().getLength(); }
+    int level() const { return arena ? arena->getLevel() : sim.getLevel(); }
+    int tickMs() const { return arena ? arena->getTickMs() : sim.getTickMs(); }
+    long long ticks() const { return arena ? arena->getTicks() : sim.getTicks(); }
+    Direction heading() const { return arena ? arena->getDirection(0) : sim.getSnake().getDirection(); }
+    bool over() const { return arena ? arena->isOver() : sim.isOver(); }
+    bool won() const { return !arena && sim.hasWon(); }
 
     void loadHighScore() {
-        // stub: could read from a file. Keep 0 if none.
-        highScore = 0;
+        if (!options.statsPath.empty()) stats.open(options.statsPath);
+        highScore = stats.bestScore();
     }
 
+    // Appends the finished game to the store; replays are not new games.
     void saveHighScore() {
-        if (score > highScore) highScore = score;
-        // stub: could write to a file
-    }
-
-    void updateGameSpeed() {
-        int level = score / 100 + 1;
-        gameSpeed = std::max(50, 200 - (level * 15));
-        currentLevel = "Level " + std::to_string(level);
+        if (stats.isOpen() && !replaying) {
+            StatsRecord r;
+            r.score = score();
+            r.length = length();
+            r.level = level();
+            r.flags = (won() ? static_cast<uint32_t>(STATS_WON) : 0u) |
+                      (autopilotUsed ? static_cast<uint32_t>(STATS_AUTOPILOT) : 0u) |
+                      (arena ? static_cast<uint32_t>(STATS_ARENA) : 0u);
+            r.ticks = ticks();
+            r.endedAt = static_cast<int64_t>(time(nullptr));
+            r.durationMs = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - episodeStart).count());
+            stats.append(r);
+        }
+        highScore = std::max(highScore, std::max(score(), stats.bestScore()));
     }
 
     void showWelcomeScreen() {
@@ -591,272 +5769,1026 @@ private:
         Console::hideCursor();
         Console::setColor(LIGHT_CYAN);
         Console::gotoxy(15, 5);
-        std::cout << "+================================================+";
+        Console::out() << "+================================================+";
         Console::gotoxy(15, 6);
-        std::cout << "|                                                |";
+        Console::out() << "|                                                |";
         Console::gotoxy(15, 7);
-        std::cout << "|          WELCOME TO SNAKE GAME                 |";
+        Console::out() << "|          WELCOME TO SNAKE GAME                 |";
         Console::gotoxy(15, 8);
-        std::cout << "|                                                |";
+        Console::out() << "|                                                |";
         Console::gotoxy(15, 9);
-        std::cout << "|                                                |";
+        Console::out() << "|                                                |";
         Console::gotoxy(15, 10);
-        std::cout << "|                                                |";
+        Console::out() << "|                                                |";
         Console::gotoxy(15, 11);
-        std::cout << "+================================================+";
+        Console::out() << "+================================================+";
 
         Console::setColor(WHITE);
         Console::gotoxy(15, 12);
-        std::cout << "| INSTRUCTIONS:                                  |";
+        Console::out() << "| INSTRUCTIONS:                                  |";
         Console::gotoxy(15, 13);
-        std::cout << "| * Use WASD or Arrow Keys to control snake      |";
+        Console::out() << "| * Use WASD or Arrow Keys to control snake      |";
         Console::gotoxy(15, 14);
-        std::cout << "| * Eat food (*) to grow and gain points         |";
+        Console::out() << "| * Eat food (*) to grow and gain points         |";
         Console::gotoxy(15, 15);
-        std::cout << "| * Special food ($) gives bonus points          |";
+        Console::out() << "| * Special food ($) gives bonus points          |";
         Console::gotoxy(15, 16);
-        std::cout << "| * Avoid hitting walls or yourself              |";
+        Console::out() << "| * Avoid hitting walls or yourself              |";
         Console::gotoxy(15, 17);
-        std::cout << "| * Press P to pause, Q to quit                  |";
+        Console::out() << "| * Press P to pause, Q to quit                  |";
         Console::gotoxy(15, 18);
-        std::cout << "| * Game speed increases with your score!        |";
+        Console::out() << "| * Game speed increases with your score!        |";
 
         Console::setColor(LIGHT_CYAN);
         Console::gotoxy(15, 19);
-        std::cout << "+================================================+";
+        Console::out() << "+================================================+";
         Console::gotoxy(15, 20);
-        std::cout << "|                                                |";
+        Console::out() << "|                                                |";
         Console::setColor(LIGHT_YELLOW);
         Console::gotoxy(15, 21);
-        std::cout << "|      Press any key to start playing!          |";
+        Console::out() << "|      Press any key to start playing!          |";
         Console::setColor(LIGHT_CYAN);
         Console::gotoxy(15, 22);
-        std::cout << "|                                                |";
+        Console::out() << "|                                                |";
         Console::gotoxy(15, 23);
-        std::cout << "+================================================+";
+        Console::out() << "+================================================+";
 
+        Console::present();
         while (Console::kbhit()) Console::getch(); // flush
         // blocking wait for key
         Console::getch_wait();
     }
 
     void showGameOverScreen() {
-        int boardWidth = board.getWidth();
-        int boardHeight = board.getHeight();
+        int boardWidth = std::max(30, board.getViewWidth());
+        int boardHeight = board.getViewHeight();
+        int shown = std::min(5, stats.topCount());
+        int x = boardWidth / 2 - 10;
+        // With the top scores the block is 15 rows; centre it on the view.
+        int y = shown > 0 ? 4 + std::max(0, (boardHeight - 15) / 2) : boardHeight / 2 + 2;
+        if (!board.showOverlay(UI_GAME_OVER, x - 5, y, 35, shown > 0 ? shown + 10 : 8)) return;
 
         Console::setColor(LIGHT_RED);
-        Console::gotoxy(boardWidth / 2 - 10, boardHeight / 2 + 2);
-        std::cout << "+==================+";
-        Console::gotoxy(boardWidth / 2 - 10, boardHeight / 2 + 3);
-        std::cout << "|   GAME OVER!     |";
-        Console::gotoxy(boardWidth / 2 - 10, boardHeight / 2 + 4);
-        std::cout << "+==================+";
+        Console::gotoxy(x, y);
+        Console::out() << "+==================+";
+        Console::gotoxy(x, y + 1);
+        Console::out() << (won() ? "|    YOU WIN!      |" : "|   GAME OVER!     |");
+        Console::gotoxy(x, y + 2);
+        Console::out() << "+==================+";
 
         Console::setColor(WHITE);
-        Console::gotoxy(boardWidth / 2 - 10, boardHeight / 2 + 5);
-        std::cout << "| Final Score: " << std::setw(3) << score << " |";
-        Console::gotoxy(boardWidth / 2 - 10, boardHeight / 2 + 6);
-        std::cout << "| High Score:  " << std::setw(3) << highScore << " |";
+        Console::gotoxy(x, y + 3);
+        Console::out() << "| Final Score: " << std::setw(3) << score() << " |";
+        Console::gotoxy(x, y + 4);
+        Console::out() << "| High Score:  " << std::setw(3) << highScore << " |";
 
         Console::setColor(LIGHT_RED);
-        Console::gotoxy(boardWidth / 2 - 10, boardHeight / 2 + 7);
-        std::cout << "+==================+";
+        Console::gotoxy(x, y + 5);
+        Console::out() << "+==================+";
+        y += 6;
+
+        if (shown > 0) {
+            Console::gotoxy(x, y);
+            Console::out() << "+--- TOP SCORES ---+";
+            for (int i = 0; i < shown; i++) {
+                const StatsTopEntry& entry = stats.top(i);
+                // The game that just ended stands out when it made the list.
+                Console::setColor(entry.index + 1 == stats.size() && !replaying ? LIGHT_YELLOW : WHITE);
+                Console::gotoxy(x, y + 1 + i);
+                Console::out() << "| " << (i + 1) << ")" << std::setw(5) << entry.score
+                               << "  len" << std::setw(4) << entry.length << " |";
+            }
+            Console::setColor(LIGHT_RED);
+            Console::gotoxy(x, y + 1 + shown);
+            Console::out() << "+------------------+";
+            y += shown + 2;
+        }
 
         Console::setColor(YELLOW);
-        Console::gotoxy(boardWidth / 2 - 15, boardHeight / 2 + 9);
-        std::cout << "Press 'R' to restart or 'Q' to quit";
+        Console::gotoxy(boardWidth / 2 - 15, y + 1);
+        Console::out() << "Press 'R' to restart or 'Q' to quit";
+        board.overlayDrawn(UI_GAME_OVER);
     }
 
 public:
-    Game() : board(30, 20),
-             score(0), highScore(0), gameOver(false), gameRunning(true),
-             paused(false), gameSpeed(150), currentLevel("Level 1"),
-             oldFoodPos(0,0), foodEaten(false) {
-        srand(static_cast<unsigned>(time(nullptr)));
+    explicit Game(const GameOptions& opts)
+           : sim(opts.config, opts.seed),
+             board(opts.config.width, opts.config.height), highScore(0), gameRunning(true),
+             paused(false), options(opts), replaying(false), autopilotUsed(opts.autopilot),
+             botRng(opts.seed, 0xB07), framesPresented(0), queuedTurnCount(0), currentLevel("Level 1") {
+        if (options.arenaSnakes > 0) {
+            arena.reset(new ArenaState(options.config, options.arenaSnakes, options.seed));
+            arenaActions.assign(static_cast<size_t>(arena->size()), STOP);
+            // Replays and the cycle autopilot assume a single snake.
+            options.recordPath.clear();
+            options.replayPath.clear();
+            options.autopilot = false;
+            autopilotUsed = false;
+        }
+        profiler.enable(!options.profilePath.empty());
+        if (!options.savePath.empty() && !arena && options.replayPath.empty()) {
+            SimulationSnapshot saved;
+            // A resumed game is not the seed's game, so it cannot be recorded.
+            if (saved.readFile(options.savePath) && sim.restore(saved)) options.recordPath.clear();
+        }
+        if (!options.recordPath.empty()) recorder.open(options.recordPath, options.config, options.seed);
+        if (!options.replayPath.empty()) replaying = player.open(options.replayPath);
         loadHighScore();
         Console::initialize();
         std::signal(SIGINT, sigintHandler);
         std::signal(SIGTERM, sigintHandler);
 
-        Console::setWindowSize(80, 30);
-        food.generateFood(board.getWidth(), board.getHeight(), snake.getBody());
-        oldFoodPos = food.getPosition();
+        Console::setWindowSize(board.preferredScreenWidth(),
+                               board.preferredScreenHeight(profiler.isEnabled()));
+        fitToTerminal();
     }
 
     ~Game() {
         Console::cleanup();
     }
 
-    void processInput() {
-        if (!Console::kbhit()) return;
-        int key = Console::getch(); // non-blocking read
-
-#ifdef _WIN32
-        if (key == 0 || key == 224) {
-            int k2 = Console::getch_wait();
-            switch (k2) {
-                case 72: snake.setDirection(UP); break;
-                case 80: snake.setDirection(DOWN); break;
-                case 75: snake.setDirection(LEFT); break;
-                case 77: snake.setDirection(RIGHT); break;
-            }
-        } else {
-            key = std::tolower(key);
-            switch (key) {
-                case 'w': snake.setDirection(UP); break;
-                case 's': snake.setDirection(DOWN); break;
-                case 'a': snake.setDirection(LEFT); break;
-                case 'd': snake.setDirection(RIGHT); break;
-                case 'p': paused = !paused; break;
-                case 'q': gameRunning = false; break;
-            }
-        }
-#else
-        // On Unix arrow keys are sequences: 27, '[', 'A'/'B'/'C'/'D'
-        if (key == 27) {
-            // small wait to allow sequence bytes to arrive
-            Console::sleep(8);
-            if (Console::kbhit()) {
-                int next = Console::getch();
-                if (next == '[') {
-                    // wait a bit for final byte
-                    Console::sleep(4);
-                    if (Console::kbhit()) {
-                        int code = Console::getch();
-                        if (code == 'A') snake.setDirection(UP);
-                        else if (code == 'B') snake.setDirection(DOWN);
-                        else if (code == 'C') snake.setDirection(RIGHT);
-                        else if (code == 'D') snake.setDirection(LEFT);
-                    }
-                }
-            }
+    // Sizes the frame to the terminal (the preferred size when it cannot be
+    // asked) and lays the board and panel out for it.
+    void fitToTerminal() {
+        int columns = board.preferredScreenWidth();
+        int rows = board.preferredScreenHeight(profiler.isEnabled());
+        Console::getTerminalSize(columns, rows);
+        if (columns != Console::frame().getWidth() || rows != Console::frame().getHeight()) {
+            Console::frame().resize(columns, rows);
         } else {
-            key = std::tolower(key);
-            switch (key) {
-                case 'w': snake.setDirection(UP); break;
-                case 's': snake.setDirection(DOWN); break;
-                case 'a': snake.setDirection(LEFT); break;
-                case 'd': snake.setDirection(RIGHT); break;
-                case 'p': paused = !paused; break;
-                case 'q': gameRunning = false; break;
-            }
+            Console::frame().invalidate();
         }
-#endif
+        board.layout(columns, rows);
+        board.resetDrawnFlags();
     }
 
-    void update() {
-        if (gameOver || paused) return;
+    // --speed only speeds up replays; a game is played at its own pace.
+    std::chrono::steady_clock::duration tickPeriod() const {
+        return std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+            std::chrono::duration<double, std::milli>(tickMs() / (replaying ? options.speed : 1.0)));
+    }
 
-        foodEaten = false;
-        snake.move();
-        updateGameSpeed();
+    // Drops repeats and reversals of the turn before it, so a quick
+    // "up, left" while heading right becomes two clean turns.
+    void queueTurn(Direction dir) {
+        Direction last = queuedTurnCount > 0 ? queuedTurns[queuedTurnCount - 1] : heading();
+        if (dir == last || isReverse(last, dir)) return;
+        if (queuedTurnCount < MAX_QUEUED_TURNS) queuedTurns[queuedTurnCount++] = dir;
+    }
 
-        Position head = snake.getHead();
-        if (!board.isValidPosition(head)) {
-            gameOver = true;
-            return;
+    // True when a key arrived.
+    bool processInput() {
+        InputCommand command;
+        bool any = false;
+        while (input.poll(command)) {
+            any = true;
+            // A replay steers itself; the keyboard only pauses and quits.
+            if (replaying && command != CMD_PAUSE && command != CMD_QUIT) continue;
+            switch (command) {
+                case CMD_UP: queueTurn(UP); break;
+                case CMD_DOWN: queueTurn(DOWN); break;
+                case CMD_LEFT: queueTurn(LEFT); break;
+                case CMD_RIGHT: queueTurn(RIGHT); break;
+                case CMD_PAUSE: paused = !paused; break;
+                case CMD_QUIT: gameRunning = false; break;
+                case CMD_RESTART: break;
+                case CMD_AUTOPILOT:
+                    if (arena) break;   // the cycle needs the board to itself
+                    options.autopilot = !options.autopilot;
+                    autopilotUsed = autopilotUsed || options.autopilot;
+                    queuedTurnCount = 0;
+                    break;
+            }
         }
+        return any;
+    }
 
-        if (snake.checkSelfCollision()) {
-            gameOver = true;
-            return;
+    void update() {
+        if (over() || paused) return;
+        if (replaying && player.episodeOver(sim)) return;
+
+        Direction turn = STOP;
+        if (replaying) {
+            turn = player.actionFor(sim);
+        } else if (options.autopilot) {
+            // Only real turns reach setDirection and the recording.
+            turn = pilot.decide(sim);
+            if (turn == sim.getSnake().getDirection()) turn = STOP;
+        } else if (queuedTurnCount > 0) {
+            turn = queuedTurns[0];
+            for (int i = 1; i < queuedTurnCount; i++) queuedTurns[i - 1] = queuedTurns[i];
+            queuedTurnCount--;
+        }
+        if (arena) {
+            // Every snake moves in the same tick.
+            arenaBotMoves(*arena, 1, arenaActions.data(), botRng);
+            arenaActions[0] = turn;
+            arena->step(arenaActions.data());
+        } else {
+            if (turn != STOP) recorder.turn(sim.getTicks(), turn);
+            sim.step(turn);
         }
+        if (over()) saveHighScore();
+        currentLevel = "Level " + std::to_string(level()) + (options.autopilot ? " AUTO" : "");
+    }
 
-        if (head == food.getPosition()) {
-            score += food.getValue();
-            snake.grow();
-            foodEaten = true;
-            oldFoodPos = food.getPosition();
-            food.generateFood(board.getWidth(), board.getHeight(), snake.getBody());
+    // After every tick: the snake's move into the back buffer. Ticks
+    // between two frames pile up there and go out together.
+    void drawTick() {
+        if (arena) return;   // drawArena redraws the view from the grid
+        if (sim.wasFoodEaten()) {
+            board.eraseFood(sim.getEatenFoodPosition());
         }
+        board.drawSnake(sim.getSnake());
     }
 
+    // Once per frame: everything else. Drawing the last move again is
+    // harmless, and it repaints the snake after resetDrawnFlags().
     void render() {
+        // Overlays come off first, so what they covered is drawn this frame.
+        if (!paused) board.hideOverlay(UI_PAUSE);
+        if (!over()) board.hideOverlay(UI_GAME_OVER);
         board.drawBorder();
 
-        if (foodEaten) {
-            board.eraseFood(oldFoodPos);
+        if (arena) {
+            board.drawArena(*arena);
+        } else {
+            board.drawSnake(sim.getSnake());
+            board.drawFood(sim.getFood());
         }
-
-        board.drawSnake(snake);
-        board.drawFood(food);
-        board.displayHeader(score, highScore, snake.getLength(), currentLevel);
+        board.displayHeader(score(), highScore, length(), currentLevel);
+        if (profiler.isEnabled()) board.displayProfile(profiler, framesPresented % 10 == 0);
         board.displayPauseMessage(paused);
 
-        if (gameOver) {
-            showGameOverScreen();
-        }
+        if (over()) showGameOverScreen();
     }
 
     void handleGameOver() {
-        if (!gameOver) return;
+        if (!over()) return;
 
-        saveHighScore();
-        while (Console::kbhit()) Console::getch();
+        InputCommand command;
+        while (input.poll(command)) {} // drop keys typed before the game ended
+
+        if (replaying) {
+            // Hold the final screen for a second, then follow the recording.
+            for (int waited = 0; waited < 1000 && gameRunning; waited += 20) {
+                if (input.poll(command) && command == CMD_QUIT) gameRunning = false;
+                Console::sleep(20);
+            }
+            if (gameRunning && player.nextEpisode()) restart();
+            else gameRunning = false;
+            return;
+        }
 
-        int choice = -1;
         while (true) {
-            if (Console::kbhit()) {
-                choice = Console::getch();
-                if (choice == -1) { Console::sleep(50); continue; }
-                choice = std::tolower(choice);
-                if (choice == 'r') { restart(); break; }
-                if (choice == 'q') { gameRunning = false; break; }
-            } else Console::sleep(50);
+            if (!input.poll(command)) {
+                Console::sleep(20);
+                continue;
+            }
+            if (command == CMD_RESTART) { restart(); break; }
+            if (command == CMD_QUIT) { gameRunning = false; break; }
         }
     }
 
     void restart() {
-        snake.reset();
-        score = 0;
-        gameOver = false;
+        recorder.reset(sim.getTicks());
+        sim.reset();
+        if (arena) arena->reset();
+        episodeStart = std::chrono::steady_clock::now();
+        autopilotUsed = options.autopilot;
         paused = false;
-        gameSpeed = 150;
+        queuedTurnCount = 0;
         currentLevel = "Level 1";
-        food.generateFood(board.getWidth(), board.getHeight(), snake.getBody());
-        Console::clearScreen();
-        board.resetDrawnFlags();
+        // The panels stay up; the next frame sends the new board and the
+        // lines of the panel that changed.
+        board.invalidateView();
     }
 
     bool isRunning() const { return gameRunning; }
 
+    // Fixed-timestep loop: wall time accumulates, and whole ticks of the
+    // current speed are simulated out of it, so the tick rate does not
+    // drift with render or terminal time. Every tick draws its delta into
+    // the back buffer; frames go to the terminal at most options.maxFps
+    // times a second, and only when something changed. A terminal that has
+    // not taken the last frame yet gets none (present() drops it), so a
+    // slow link costs frames, never ticks.
     void run() {
+        typedef std::chrono::steady_clock Clock;
+        const Clock::duration maxCatchUp = std::chrono::milliseconds(250);
+        const Clock::duration frameInterval = std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(1.0 / std::max(1, options.maxFps)));
+
         showWelcomeScreen();
         Console::clearScreen();
+        input.start();
+        episodeStart = Clock::now();
 
+        Clock::time_point previous = Clock::now();
+        Clock::time_point deadline = previous;
+        Clock::duration accumulator = Clock::duration::zero();
+        Clock::time_point nextFrame = previous;
+        bool changed = true;
         while (gameRunning) {
-            processInput();
-            update();
-            render();
+            Clock::time_point now = Clock::now();
+            if (now >= deadline) jitter.record(now - deadline);
+            accumulator += std::min(now - previous, maxCatchUp);
+            previous = now;
 
-            if (gameOver) {
-                handleGameOver();
-            } else if (!paused) {
-                Console::sleep(gameSpeed);
+            {
+                FrameProfiler::Scope timing(profiler, PHASE_INPUT);
+                if (processInput()) changed = true;
+            }
+            if (Console::consumeResize()) {
+                fitToTerminal();
+                changed = true;
+            }
+
+            if (paused || over()) accumulator = Clock::duration::zero();
+            while (!paused && !over() && accumulator >= tickPeriod()) {
+                accumulator -= tickPeriod();
+                {
+                    FrameProfiler::Scope timing(profiler, PHASE_UPDATE);
+                    update();
+                }
+                FrameProfiler::Scope timing(profiler, PHASE_RENDER);
+                drawTick();
+                changed = true;
+            }
+
+            // The game-over screen goes out at once, whatever the cap.
+            if (changed && (now >= nextFrame || over())) {
+                {
+                    FrameProfiler::Scope timing(profiler, PHASE_RENDER);
+                    render();
+                }
+                FrameProfiler::Scope timing(profiler, PHASE_PRESENT);
+                size_t bytes = Console::present();
+                if (!Console::frame().wasLastFrameDropped()) {
+                    profiler.addFrame(bytes, Console::frame().getLastWriteCalls());
+                    framesPresented++;
+                    changed = false;
+                }
+                nextFrame = now + frameInterval;
             } else {
-                Console::sleep(100);
+                Console::frame().flush();
+            }
+
+            if (over()) {
+                // The final screen reaches the terminal, however slow it is.
+                Console::frame().drain();
+                if (changed) {
+                    render();
+                    Console::present();
+                    Console::frame().drain();
+                }
+                handleGameOver();
+                previous = deadline = nextFrame = Clock::now();
+                changed = true;
+                continue;
             }
+            // A recording quit mid-game ends here too.
+            if (replaying && player.episodeOver(sim)) gameRunning = false;
+            Clock::duration wait = paused ? Clock::duration(std::chrono::milliseconds(50))
+                                          : Clock::duration(tickPeriod() - accumulator);
+            if (changed) wait = std::min(wait, Clock::duration(nextFrame - Clock::now()));
+            deadline = Clock::now() + wait;
+            FrameProfiler::Scope timing(profiler, PHASE_SLEEP);
+            std::this_thread::sleep_until(deadline);
         }
+        input.stop();
+        recorder.finish(sim.getTicks());
+        if (!options.savePath.empty() && !arena && !replaying) {
+            // A finished game leaves nothing to resume.
+            SimulationSnapshot saved;
+            sim.snapshot(saved);
+            if (sim.isOver()) std::remove(options.savePath.c_str());
+            else saved.writeFile(options.savePath);
+        }
+        if (profiler.isEnabled()) profiler.writeJson(options.profilePath);
 
         Console::clearScreen();
         Console::setColor(LIGHT_CYAN);
         Console::gotoxy(25, 10);
-        std::cout << "Thanks for playing Snake Game!";
+        Console::out() << "Thanks for playing Snake Game!";
         Console::gotoxy(25, 11);
-        std::cout << "Final Score: " << score;
+        Console::out() << "Final Score: " << score();
         Console::gotoxy(25, 12);
-        std::cout << "High Score: " << highScore;
-        Console::gotoxy(0, 15);
+        Console::out() << "High Score: " << highScore;
+        Console::gotoxy(25, 13);
+        Console::out() << "Tick jitter: " << std::fixed << std::setprecision(2)
+                       << jitter.meanMs() << " ms avg, " << jitter.maxMs() << " ms max";
+        Console::gotoxy(25, 14);
+        Console::out() << "Frames: " << framesPresented << " shown, "
+                       << Console::frame().getDroppedFrames() << " dropped on a busy terminal";
+        Console::gotoxy(0, 16);
+        Console::present(true);
+        Console::showCursor();
+        Console::setColor(WHITE);
+    }
+};
+
+#ifndef _WIN32
+// ---------------------------- Spectator View ----------------------------
+// Watches a SpectatorServer: the stream feeds a SpectatorMirror, and the
+// mirror is drawn with the game's own GameBoard, so a tick redraws only
+// the cells it changed, as in play. Q quits.
+class SpectatorView {
+private:
+    int fd;
+    SpectatorMirror mirror;
+    std::unique_ptr<GameBoard> board;
+    InputThread input;
+    int bestScore;
+    std::string error;
+
+    bool connectTo(const std::string& host, const std::string& port) {
+        addrinfo hints;
+        std::memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* found = nullptr;
+        int status = ::getaddrinfo(host.c_str(), port.c_str(), &hints, &found);
+        if (status != 0) {
+            error = gai_strerror(status);
+            return false;
+        }
+        for (addrinfo* a = found; a && fd < 0; a = a->ai_next) {
+            fd = ::socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol);
+            if (fd >= 0 && ::connect(fd, a->ai_addr, a->ai_addrlen) != 0) {
+                error = std::strerror(errno);
+                ::close(fd);
+                fd = -1;
+            }
+        }
+        ::freeaddrinfo(found);
+        return fd >= 0;
+    }
+
+    // Waits up to timeoutMs for data and applies all of it. False when the
+    // server has gone or sent something that is not a stream.
+    bool receive(int timeoutMs) {
+        struct pollfd socketReady = { fd, POLLIN, 0 };
+        if (::poll(&socketReady, 1, timeoutMs) <= 0) return true;
+        unsigned char bytes[65536];
+        ssize_t n = ::recv(fd, bytes, sizeof(bytes), MSG_DONTWAIT);
+        if (n == 0) {
+            error = "the server closed the connection";
+            return false;
+        }
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) return true;
+            error = std::strerror(errno);
+            return false;
+        }
+        if (!mirror.feed(bytes, static_cast<size_t>(n))) {
+            error = mirror.getError();
+            return false;
+        }
+        return true;
+    }
+
+    void fitToTerminal() {
+        int columns = board->preferredScreenWidth();
+        int rows = board->preferredScreenHeight(false);
+        Console::getTerminalSize(columns, rows);
+        Console::frame().resize(columns, rows);
+        board->layout(columns, rows);
+        board->resetDrawnFlags();
+    }
+
+    void render() {
+        if (mirror.consumeRepaint()) board->resetDrawnFlags();
+        if (!mirror.isOver()) board->hideOverlay(UI_GAME_OVER);
+        bestScore = std::max(bestScore, mirror.getScore());
+        board->drawBorder();
+        board->drawSnake(mirror.getSnake());
+        board->drawFood(mirror.getFood());
+        board->displayHeader(mirror.getScore(), bestScore, mirror.getSnake().getLength(),
+                             "Level " + std::to_string(mirror.getLevel()) + " LIVE");
+        int x = board->getViewWidth() / 2 - 4, y = board->getViewHeight() / 2 + 4;
+        if (mirror.isOver() && board->showOverlay(UI_GAME_OVER, x, y, 9, 1)) {
+            Console::setColor(LIGHT_RED);
+            Console::gotoxy(x, y);
+            Console::out() << (mirror.hasWon() ? " WON! " : "GAME OVER");
+            board->overlayDrawn(UI_GAME_OVER);
+        }
+    }
+
+public:
+    SpectatorView() : fd(-1), bestScore(0) {}
+    ~SpectatorView() {
+        if (fd >= 0) ::close(fd);
+    }
+
+    // `address` is host:port. Returns the process exit code.
+    int run(const std::string& address) {
+        size_t colon = address.rfind(':');
+        if (colon == std::string::npos || colon == 0 || colon + 1 == address.size()) {
+            std::fprintf(stderr, "--watch takes host:port\n");
+            return 1;
+        }
+        if (!connectTo(address.substr(0, colon), address.substr(colon + 1))) {
+            std::fprintf(stderr, "%s: %s\n", address.c_str(), error.c_str());
+            return 1;
+        }
+        std::chrono::steady_clock::time_point giveUp = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (!mirror.isSynced()) {
+            if (!receive(100) || std::chrono::steady_clock::now() > giveUp) {
+                std::fprintf(stderr, "%s: %s\n", address.c_str(),
+                             error.empty() ? "no game from the server" : error.c_str());
+                return 1;
+            }
+        }
+
+        board.reset(new GameBoard(mirror.getConfig().width, mirror.getConfig().height));
+        input.start();
+        Console::hideCursor();
+        Console::clearScreen();
+        fitToTerminal();
+        bool watching = true;
+        while (watching) {
+            watching = receive(50);
+            InputCommand command;
+            while (input.poll(command)) {
+                if (command == CMD_QUIT) watching = false;
+            }
+            if (Console::consumeResize()) fitToTerminal();
+            render();
+            Console::present();
+        }
+        input.stop();
+
+        Console::clearScreen();
+        Console::setColor(LIGHT_CYAN);
+        Console::gotoxy(25, 10);
+        Console::out() << "Stopped watching " << address;
+        if (!error.empty()) {
+            Console::gotoxy(25, 11);
+            Console::out() << error;
+        }
+        Console::gotoxy(0, 13);
+        Console::present(true);
         Console::showCursor();
         Console::setColor(WHITE);
+        return 0;
     }
 };
+#endif // _WIN32
+
+// ---------------------------- C API ----------------------------
+// Define SNAKECYCLE_C_API to build the batch as a shared library for other
+// languages; it implies SNAKECYCLE_NO_MAIN:
+//
+//   g++ -O2 -shared -fPIC -pthread -DSNAKECYCLE_C_API snakeCycle.cpp -o libsnakecycle.so
+//
+// An environment is a SnakeBatch of `count` games. Actions are int32 per
+// game (0 up, 1 down, 2 left, 3 right, 4 keep going); observations are
+// float32 in the ObservationLayout given by the strides, packed
+// [count][PLANE_COUNT][height][width] unless set otherwise, and written
+// into the caller's buffer, so NumPy can hand over an array as is. A game
+// that ends is reset within the same step: its done flag is set and the
+// observation is already the new game's.
+#ifdef SNAKECYCLE_C_API
+#ifndef SNAKECYCLE_NO_MAIN
+#define SNAKECYCLE_NO_MAIN
+#endif
+#ifdef _WIN32
+#define SNAKECYCLE_EXPORT __declspec(dllexport)
+#else
+#define SNAKECYCLE_EXPORT __attribute__((visibility("default")))
+#endif
+
+struct SnakeEnv {
+    SnakeBatch batch;
+    ObservationLayout layout;
+    std::vector<Direction> actions;
+    std::vector<int32_t> lastScore;
+
+    SnakeEnv(int count, const SimulationConfig& config, uint64_t seed)
+        : batch(count, config, seed), layout(config.width, config.height),
+          actions(static_cast<size_t>(count), STOP), lastScore(static_cast<size_t>(count), 0) {}
+};
+
+extern "C" {
+
+// NULL for a board outside 4x1 .. MAX_BOARD_CELLS, no games, more cells
+// over all the games than MAX_BOARD_CELLS, or too little memory: nothing
+// may throw into the caller's process.
+SNAKECYCLE_EXPORT SnakeEnv* snake_env_create(int count, int width, int height, uint64_t seed) {
+    if (count < 1 || width < 4 || height < 1 ||
+        static_cast<long long>(width) * height > MAX_BOARD_CELLS ||
+        static_cast<long long>(width) * height * count > MAX_BOARD_CELLS) return nullptr;
+    try {
+        return new SnakeEnv(count, SimulationConfig(width, height), seed);
+    } catch (const std::bad_alloc&) {
+        return nullptr;
+    }
+}
+
+SNAKECYCLE_EXPORT void snake_env_destroy(SnakeEnv* env) { delete env; }
+
+SNAKECYCLE_EXPORT int snake_env_count(const SnakeEnv* env) { return env->batch.size(); }
+
+SNAKECYCLE_EXPORT void snake_env_shape(const SnakeEnv* env, int* planes, int* height, int* width) {
+    *planes = PLANE_COUNT;
+    *height = env->layout.height;
+    *width = env->layout.width;
+}
+
+// Strides in floats, e.g. for a channels-last array or one with padding
+// (NumPy's strides divided by 4).
+SNAKECYCLE_EXPORT void snake_env_set_strides(SnakeEnv* env, ptrdiff_t envStride, ptrdiff_t planeStride,
+                                             ptrdiff_t rowStride, ptrdiff_t cellStride) {
+    env->layout.envStride = envStride;
+    env->layout.planeStride = planeStride;
+    env->layout.rowStride = rowStride;
+    env->layout.cellStride = cellStride;
+}
+
+// Restarts every game; observations may be NULL.
+SNAKECYCLE_EXPORT void snake_env_reset(SnakeEnv* env, float* observations) {
+    env->batch.resetAll();
+    std::fill(env->lastScore.begin(), env->lastScore.end(), 0);
+    if (observations) env->batch.writeObservations(0, env->batch.size(), observations, env->layout);
+}
+
+// The current state again, e.g. into a second buffer.
+SNAKECYCLE_EXPORT void snake_env_observe(const SnakeEnv* env, float* observations) {
+    env->batch.writeObservations(0, env->batch.size(), observations, env->layout);
+}
+
+// One tick of every game. rewards get the points scored this tick and dones
+// 1 where the game ended (won or lost); any of the outputs may be NULL.
+SNAKECYCLE_EXPORT void snake_env_step(SnakeEnv* env, const int32_t* actions, float* observations,
+                                      float* rewards, uint8_t* dones) {
+    SnakeBatch& batch = env->batch;
+    for (int i = 0; i < batch.size(); i++) {
+        env->actions[i] = actions[i] >= UP && actions[i] <= STOP ? static_cast<Direction>(actions[i]) : STOP;
+    }
+    batch.stepAll(env->actions.data());
+    for (int i = 0; i < batch.size(); i++) {
+        bool done = batch.isDone(i);
+        if (rewards) rewards[i] = static_cast<float>(batch.getScore(i) - env->lastScore[i]);
+        if (dones) dones[i] = done ? 1 : 0;
+        env->lastScore[i] = batch.getScore(i);
+        if (done) {
+            batch.resetEnv(i);
+            env->lastScore[i] = 0;
+        }
+    }
+    if (observations) batch.writeObservations(0, batch.size(), observations, env->layout);
+}
+
+} // extern "C"
+#endif // SNAKECYCLE_C_API
+
+// Define SNAKECYCLE_NO_MAIN to include this file from another target (the
+// benchmarks) and reuse everything above without the game's entry point.
+#ifndef SNAKECYCLE_NO_MAIN
+
+// ---------------------------- Headless Runs ----------------------------
+static void printTotals(const char* label, const RunTotals& totals, double seconds, int threads) {
+    std::printf("%s: episodes=%lld steps=%lld wins=%lld mean_score=%.2f best_score=%d "
+                "threads=%d seconds=%.3f steps_per_sec=%.0f\n",
+                label, totals.episodes, totals.steps, totals.wins, totals.meanScore(),
+                totals.bestScore, threads, seconds, seconds > 0 ? totals.steps / seconds : 0.0);
+#ifdef SNAKECYCLE_COUNT_ALLOCATIONS
+    std::printf("%s: warmup_allocations=%lld step_allocations=%lld\n", label, totals.warmupAllocations,
+                totals.stepAllocations);
+#endif
+}
+
+// Episodes first..first+episodes-1 with the random agent or the autopilot.
+static RunTotals playHeadless(ParallelRunner& runner, const SimulationConfig& config, long long episodes,
+                              bool autopilot, long long maxTicks, long long first = 0) {
+    if (!autopilot && config == SimulationConfig()) {
+        // The default board has a compile-time build; same games, faster.
+        typedef FixedSimulation<30, 20> ClassicSimulation;
+        return runner.runFixedEpisodes<ClassicSimulation>(
+            episodes, [](const ClassicSimulation& sim, Pcg32& rng) { return fixedSafeRandomPolicy(sim, rng); },
+            maxTicks, first);
+    }
+    return runner.runEpisodes(config, episodes, autopilot ? autopilotPolicy : safeRandomPolicy, maxTicks, first);
+}
+
+static int runHeadless(const SimulationConfig& config, long long episodes, int batchSize, int batchSteps,
+                       int threads, uint64_t seed, const std::string& statsPath, bool autopilot,
+                       long long maxTicks) {
+    ParallelRunner runner(threads, seed);
+    StatsStore stats;
+    if (!statsPath.empty() && !stats.open(statsPath)) {
+        std::fprintf(stderr, "%s: cannot open stats store\n", statsPath.c_str());
+        return 1;
+    }
+    runner.setStatsStore(stats.isOpen() ? &stats : nullptr);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    RunTotals totals;
+    if (batchSize > 0) {
+        SnakeBatch batch(batchSize, config, seed);
+        totals = runner.runBatch(batch, batchSteps, autopilot ? autopilotBatchPolicy : safeRandomBatchPolicy);
+    } else {
+        totals = playHeadless(runner, config, episodes, autopilot, maxTicks);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printTotals(batchSize > 0 ? "batch" : "episodes", totals, seconds, runner.threadCount());
+    if (runner.statsWriteFailed()) {
+        std::fprintf(stderr, "%s: could not store every game\n", statsPath.c_str());
+        return 1;
+    }
+    if (stats.isOpen()) {
+        std::printf("stats: %llu games stored, best score %d\n",
+                    static_cast<unsigned long long>(stats.size()), stats.bestScore());
+    }
+    return 0;
+}
+
+// Plays `episodes` episodes under every configuration of the grid and
+// writes each one's result to `path`. Runs go in waves of up to 2^20
+// episodes, so the columns stay a few MB however long the sweep is.
+static int runSweep(const std::string& path, const std::string& grid, const SweepConfig& base,
+                    long long episodes, long long maxTicks, int threads, uint64_t seed) {
+    std::vector<SweepConfig> configs;
+    std::string error;
+    if (!parseSweepGrid(grid, base, configs, error)) {
+        std::fprintf(stderr, "--grid: %s\n", error.c_str());
+        return 1;
+    }
+    SweepWriter writer;
+    if (!writer.open(path, configs)) {
+        std::fprintf(stderr, "%s: %s\n", path.c_str(), std::strerror(errno));
+        return 1;
+    }
+    const long long wave = 1LL << 20;
+    ParallelRunner runner(threads, seed);
+    EpisodeColumns columns;
+    runner.setColumns(&columns);
+    RunTotals all;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t c = 0; c < configs.size(); c++) {
+        const SweepConfig& sweep = configs[c];
+        RunTotals totals;
+        for (long long first = 0; first < episodes; first += wave) {
+            long long rows = std::min(wave, episodes - first);
+            columns.first = first;
+            columns.resize(static_cast<size_t>(rows));
+            totals.merge(playHeadless(runner, sweep.config, rows, sweep.policy == SWEEP_AUTOPILOT, maxTicks, first));
+            if (!writer.block(static_cast<uint32_t>(c), columns)) {
+                std::fprintf(stderr, "%s: write failed\n", path.c_str());
+                return 1;
+            }
+        }
+        const SimulationConfig& cfg = sweep.config;
+        std::printf("config %zu: size=%dx%d special=%d points=%d policy=%s "
+                    "episodes=%lld mean_score=%.2f best_score=%d wins=%lld mean_ticks=%.1f\n",
+                    c, cfg.width, cfg.height, cfg.specialFoodPercent, cfg.pointsPerLevel, sweep.policy == SWEEP_AUTOPILOT ? "autopilot" : "random",
+                    totals.episodes, totals.meanScore(), totals.bestScore, totals.wins,
+                    totals.episodes ? static_cast<double>(totals.steps) / totals.episodes : 0.0);
+        std::fflush(stdout);
+        all.merge(totals);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (!writer.close()) {
+        std::fprintf(stderr, "%s: write failed\n", path.c_str());
+        return 1;
+    }
+    printTotals("sweep", all, seconds, runner.threadCount());
+    return 0;
+}
+
+// An arena of bots only, stepped `ticks` times on this thread.
+static int runArena(const SimulationConfig& config, int snakeCount, long long ticks, uint64_t seed) {
+    ArenaState arena(config, snakeCount, seed);
+    arena.setPlayers(0);
+    std::vector<Direction> actions(static_cast<size_t>(arena.size()), STOP);
+    Pcg32 botRng(seed, 0xB07);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (long long t = 0; t < ticks; t++) {
+        arenaBotMoves(arena, 0, actions.data(), botRng);
+        arena.step(actions.data());
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    int alive = 0;
+    for (int i = 0; i < arena.size(); i++) alive += arena.isAlive(i) ? 1 : 0;
+    double nsPerTick = ticks > 0 ? seconds * 1e9 / ticks : 0.0;
+    std::printf("arena: ticks=%lld snakes=%d alive=%d deaths=%lld meals=%lld body_cells=%d "
+                "seconds=%.3f ns_per_tick=%.0f ns_per_snake=%.1f\n",
+                arena.getTicks(), arena.size(), alive, arena.getDeaths(), arena.getMeals(),
+                arena.getBodyCells(), seconds, nsPerTick, nsPerTick / arena.size());
+    return 0;
+}
+
+// Fast-forwards a replay through the headless core, one line per episode.
+static int runReplay(const std::string& path) {
+    ReplayPlayer player;
+    if (!player.open(path)) {
+        std::fprintf(stderr, "%s: %s\n", path.c_str(), player.getReader().getError().c_str());
+        return 1;
+    }
+    SimulationState sim(player.getReader().getConfig(), player.getReader().getSeed());
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    long long totalTicks = 0;
+    for (int episode = 1;; episode++) {
+        while (!player.episodeOver(sim)) sim.step(player.actionFor(sim));
+        totalTicks += sim.getTicks();
+        std::printf("episode %d: score=%d length=%d ticks=%lld end=%s\n", episode, sim.getScore(),
+                    sim.getSnake().getLength(), sim.getTicks(),
+                    sim.hasWon() ? "won" : sim.isOver() ? "died" : "quit");
+        if (!player.nextEpisode()) break;
+        sim.reset();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::printf("replay: ticks=%lld seconds=%.6f ticks_per_sec=%.0f\n", totalTicks, seconds,
+                seconds > 0 ? totalTicks / seconds : 0.0);
+    return 0;
+}
 
 // ---------------------------- main ----------------------------
-int main() {
+// Where the game keeps its high scores unless --stats says otherwise.
+static std::string defaultStatsPath() {
+#ifdef _WIN32
+    const char* home = std::getenv("USERPROFILE");
+#else
+    const char* home = std::getenv("HOME");
+#endif
+    return home && *home ? std::string(home) + "/.snakecycle_stats" : std::string(".snakecycle_stats");
+}
+
+static void printUsage(const char* program) {
+    std::printf("usage: %s [options]\n"
+                "  (no options)         play in the terminal\n"
+                "  --simulate N         play N headless episodes with the random agent\n"
+                "  --batch N            step a batch of N games instead (with --steps)\n"
+                "  --steps S            steps per game for --batch (default 1000)\n"
+                "  --threads T          worker threads for headless runs (default: all cores)\n"
+                "  --max-ticks T        end a headless episode after T ticks (default 1000000)\n"
+                "  --sweep FILE         with --simulate N: play N episodes under every\n"
+                "                       configuration of --grid, one row each into FILE\n"
+                "  --grid SPEC          the sweep's grid, e.g. \"size=30x20,60x40;special=0,10;\n"
+                "                       points=100;policy=random,autopilot\"\n"
+                "  --autopilot          let the Hamiltonian-cycle autopilot play (game and\n"
+                "                       headless runs; C toggles it in game)\n"
+                "  --arena N            play against N - 1 bots on one board; with --simulate T,\n"
+                "                       step T ticks of N bots headless instead\n"
+                "  --seed S             seed every random choice; same seed, same run\n"
+                "  --width W            board width in cells (default 30)\n"
+                "  --height H           board height in cells (default 20)\n"
+                "  --profile FILE       show frame timings in game, write them as JSON on exit\n"
+                "  --fps N              send at most N frames a second to the terminal (default 60)\n"
+                "  --stats FILE         keep high scores and per-game stats here (games default\n"
+                "                       to ~/.snakecycle_stats; headless runs only with this)\n"
+                "  --record FILE        record the session's turns as a replay\n"
+                "  --save FILE          resume the game saved in FILE, and save it there on quit\n"
+                "  --replay FILE        fast-forward a replay headless and print each game\n"
+                "  --speed X            with --replay: watch it in the terminal at X times speed\n"
+                "                       (above 0, at most 1000);\n"
+                "                       with --serve: tick X times faster than the game\n"
+                "  --serve PORT         play headless and stream the game to viewers on PORT\n"
+                "                       (Linux; --autopilot picks the player)\n"
+                "  --watch HOST:PORT    watch a --serve game in the terminal\n",
+                program);
+}
+
+int main(int argc, char** argv) {
+    long long episodes = 0;
+    int batchSize = 0;
+    int batchSteps = 1000;
+    int threads = 0;
+    long long maxTicks = 1000000;
+    uint64_t seed = clockSeed();
+    SimulationConfig config;
+    GameOptions gameOptions;
+    bool watchReplay = false;
+    int arenaSnakes = 0;
+    int servePort = 0;
+    std::string watchAddress;
+    std::string sweepPath;
+    std::string sweepGrid;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--simulate" && hasValue) episodes = std::atoll(argv[++i]);
+        else if (arg == "--batch" && hasValue) batchSize = std::atoi(argv[++i]);
+        else if (arg == "--steps" && hasValue) batchSteps = std::atoi(argv[++i]);
+        else if (arg == "--threads" && hasValue) threads = std::atoi(argv[++i]);
+        else if (arg == "--max-ticks" && hasValue) maxTicks = std::max(1LL, std::atoll(argv[++i]));
+        else if (arg == "--sweep" && hasValue) sweepPath = argv[++i];
+        else if (arg == "--grid" && hasValue) sweepGrid = argv[++i];
+        else if (arg == "--seed" && hasValue) seed = std::strtoull(argv[++i], nullptr, 10);
+        else if (arg == "--width" && hasValue) config.width = std::atoi(argv[++i]);
+        else if (arg == "--height" && hasValue) config.height = std::atoi(argv[++i]);
+        else if (arg == "--profile" && hasValue) gameOptions.profilePath = argv[++i];
+        else if (arg == "--fps" && hasValue) gameOptions.maxFps = std::max(1, std::atoi(argv[++i]));
+        else if (arg == "--stats" && hasValue) gameOptions.statsPath = argv[++i];
+        else if (arg == "--record" && hasValue) gameOptions.recordPath = argv[++i];
+        else if (arg == "--save" && hasValue) gameOptions.savePath = argv[++i];
+        else if (arg == "--replay" && hasValue) gameOptions.replayPath = argv[++i];
+        else if (arg == "--autopilot") gameOptions.autopilot = true;
+        else if (arg == "--arena" && hasValue) arenaSnakes = std::atoi(argv[++i]);
+        else if (arg == "--serve" && hasValue) servePort = std::atoi(argv[++i]);
+        else if (arg == "--watch" && hasValue) watchAddress = argv[++i];
+        else if (arg == "--speed" && hasValue) {
+            gameOptions.speed = std::atof(argv[++i]);
+            watchReplay = true;
+        }
+        else {
+            printUsage(argv[0]);
+            return arg == "--help" || arg == "-h" ? 0 : 1;
+        }
+    }
+    if (config.width < 4 || config.height < 1 ||
+        static_cast<long long>(config.width) * config.height > MAX_BOARD_CELLS) {
+        std::fprintf(stderr, "board must be at least 4x1 and at most %lld cells\n", MAX_BOARD_CELLS);
+        return 1;
+    }
+    if (arenaSnakes != 0 && (arenaSnakes < 2 || arenaSnakes > MAX_ARENA_SNAKES)) {
+        std::fprintf(stderr, "--arena takes 2 to %d snakes\n", MAX_ARENA_SNAKES);
+        return 1;
+    }
+    // Also keeps the tick period finite and above zero (NaN fails too).
+    if (!(gameOptions.speed > 0 && gameOptions.speed <= GameOptions::MAX_SPEED)) {
+        std::fprintf(stderr, "--speed takes a number above 0 and at most %g\n", GameOptions::MAX_SPEED);
+        return 1;
+    }
+    if (arenaSnakes > 0 && episodes > 0) return runArena(config, arenaSnakes, episodes, seed);
+    if (servePort != 0) {
+#ifdef __linux__
+        if (servePort < 1 || servePort > 65535) {
+            std::fprintf(stderr, "--serve takes a port from 1 to 65535\n");
+            return 1;
+        }
+        SpectatorServer server(config, seed, gameOptions.autopilot);
+        if (!server.listen(servePort)) {
+            std::fprintf(stderr, "port %d: %s\n", servePort, server.getError().c_str());
+            return 1;
+        }
+        std::printf("serve: port=%d board=%dx%d\n", servePort, config.width, config.height);
+        std::fflush(stdout);
+        server.run(gameOptions.speed);
+        return 0;
+#else
+        std::fprintf(stderr, "--serve needs Linux (epoll)\n");
+        return 1;
+#endif
+    }
+    if (!watchAddress.empty()) {
+#ifndef _WIN32
+        std::signal(SIGINT, sigintHandler);
+        std::signal(SIGTERM, sigintHandler);
+        SpectatorView view;
+        return view.run(watchAddress);
+#else
+        std::fprintf(stderr, "--watch is not available on Windows yet\n");
+        return 1;
+#endif
+    }
+    if (!sweepPath.empty()) {
+        if (episodes <= 0) {
+            std::fprintf(stderr, "--sweep needs --simulate N, the episodes per configuration\n");
+            return 1;
+        }
+        SweepConfig base;
+        base.config = config;
+        base.policy = gameOptions.autopilot ? SWEEP_AUTOPILOT : SWEEP_RANDOM;
+        return runSweep(sweepPath, sweepGrid, base, episodes, maxTicks, threads, seed);
+    }
+    if (episodes > 0 || batchSize > 0) {
+        return runHeadless(config, episodes, batchSize, batchSteps, threads, seed, gameOptions.statsPath,
+                           gameOptions.autopilot, maxTicks);
+    }
+
     std::signal(SIGINT, sigintHandler);
     std::signal(SIGTERM, sigintHandler);
-    Game game;
+    gameOptions.seed = seed;
+    gameOptions.config = config;
+    if (gameOptions.statsPath.empty()) gameOptions.statsPath = defaultStatsPath();
+    if (!gameOptions.replayPath.empty()) {
+        if (!watchReplay) return runReplay(gameOptions.replayPath);
+        // The recording decides the board, the rules and the seed.
+        ReplayReader header;
+        if (!header.open(gameOptions.replayPath)) {
+            std::fprintf(stderr, "%s: %s\n", gameOptions.replayPath.c_str(), header.getError().c_str());
+            return 1;
+        }
+        gameOptions.config = header.getConfig();
+        gameOptions.seed = header.getSeed();
+        gameOptions.recordPath.clear();
+        arenaSnakes = 0;
+    }
+    gameOptions.arenaSnakes = arenaSnakes;
+    SimulationSnapshot saved;
+    SimulationSnapshot::Header savedHeader;
+    if (!gameOptions.savePath.empty() && arenaSnakes == 0 && gameOptions.replayPath.empty() &&
+        saved.readFile(gameOptions.savePath) && saved.header(savedHeader)) {
+        if (!savedHeader.config.isValid()) {
+            // The board is held to the limits of --width and --height.
+            std::fprintf(stderr, "%s: corrupt save file\n", gameOptions.savePath.c_str());
+            return 1;
+        }
+        gameOptions.config = savedHeader.config;   // the saved board, whatever --width says
+    }
+    Game game(gameOptions);
     game.run();
     return 0;
 }
+#endif // SNAKECYCLE_NO_MAIN